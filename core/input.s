@@ -0,0 +1,238 @@
+	; Interrupt-driven input for rixty502 programs.
+	;
+	; The ROM's RDKEY (and the simulator's stdio port) block the whole machine while waiting for a key, and bytes that
+	; arrive over the serial port while the interpreter is busy are simply lost. This module instead lets ACIA 2 (the
+	; //c's modem port) interrupt the processor whenever a byte arrives. The interrupt handler appends the byte to a
+	; 256-byte ring buffer, and programs drain the ring buffer through the ecall entry points below at their leisure.
+	; On real hardware the keyboard feeds the same ring buffer: it can't interrupt, so the entry points move any key
+	; waiting in its latch into the buffer each time they are called.
+	;
+	; The entry points are reached through the interpreter's vector table at the start of the image (see riscv.s) so
+	; that RISC-V programs can ecall them regardless of how the rest of the interpreter is laid out:
+	;
+	;     $0806: kbpoll -- returns the next buffered byte (with the high bit set) in A, or 0 if the buffer is empty.
+	;     $0809: kbread -- copies up to Y buffered bytes (high bit clear) to the address in A/X; returns the count in A.
+	;     $080c: kbgetc -- waits for the next byte and returns it in A with the high bit set, like RDKEY.
+
+	acdr = $c0a8  ; ACIA 2's data register
+	acsr = $c0a9  ; ACIA 2's status register
+	accmd = $c0aa ; ACIA 2's command register
+	acctl = $c0ab ; ACIA 2's control register
+
+	kbd = $c000     ; The keyboard latch: bit 7 is set while a key is waiting.
+	kbdstrb = $c010 ; Accessing this clears the keyboard latch's bit 7.
+
+	irqloc = $03fe ; The //c firmware passes non-firmware interrupts to the routine whose address is stored here.
+
+	; The ring buffer's state lives in the zero page just above the interpreter's private state. The buffer is empty
+	; when inhead == intail and full when intail+1 == inhead; one slot is sacrificed to tell the two apart.
+	;
+	; Input is never dropped. When a byte arrives to a full buffer, kbirq leaves it in the ACIA, masks receive
+	; interrupts and drops RTS. The ACIA can't take another byte until that one is read, so the sender has to wait,
+	; and kbpoll and kbread restart reception through kbresume once they have made room.
+	inhead = $14 ; The index of the next byte to read from inbuf.
+	intail = $15 ; The index of the next free slot in inbuf.
+	inptr = $16  ; The destination address of a kbread.
+	incnt = $18  ; The maximum number of bytes to copy in a kbread.
+	inhold = $19 ; Bit 7 is set while kbirq has stopped reception because inbuf is full.
+
+.segment "CODE"
+	; kbinit resets the ring buffer, installs the interrupt handler, and enables receive interrupts on the ACIA. It is
+	; called once by the interpreter's start routine.
+.proc kbinit
+	lda #0
+	sta inhead
+	sta intail
+	sta inhold
+
+	; The simulator vectors IRQs directly to kbirq via $fffe. Real hardware goes through the firmware's handler.
+.if .not .defined(simulator)
+	lda #<kbirq
+	sta irqloc
+	lda #>kbirq
+	sta irqloc+1
+.endif
+
+	lda #$1e     ; 9600bps, 8n1
+	sta acctl
+	lda #$09     ; TX disabled, RX IRQ enabled, DTR on
+	sta accmd
+	lda acdr     ; Discard any stale byte.
+	cli
+	rts
+.endproc
+.export kbinit
+
+	; kbirq is the ACIA's interrupt handler. Reading the status register acknowledges the interrupt; if a byte has
+	; arrived, it is appended to the ring buffer. If the buffer is full, the byte stays in the ACIA and reception
+	; stops until kbresume.
+.proc kbirq
+	pha
+	txa
+	pha
+	lda acsr
+	and #$08     ; Is the receive data register full?
+	beq done
+	ldx intail
+	inx
+	cpx inhead
+	beq full
+	dex
+	lda acdr
+	sta inbuf,x
+	inx
+	stx intail
+done:
+	pla
+	tax
+	pla
+	rti
+full:
+	lda #$03     ; TX disabled, RX IRQ disabled, RTS off, DTR on
+	sta accmd
+	lda #$80
+	sta inhold
+	bne done
+.endproc
+.export kbirq
+
+	; kbresume restarts reception after kbirq stopped it, if the buffer has room again. The byte left waiting in the
+	; ACIA has had its interrupt acknowledged already, so it is moved into the buffer here. Clobbers A and X.
+.proc kbresume
+	php
+	sei
+	ldx intail
+	inx
+	cpx inhead
+	beq done     ; Still full.
+	lda acsr
+	and #$08
+	beq on
+	dex
+	lda acdr
+	sta inbuf,x
+	inx
+	stx intail
+on:
+	lda #0
+	sta inhold
+	lda #$09     ; TX disabled, RX IRQ enabled, DTR on
+	sta accmd
+done:
+	plp
+	rts
+.endproc
+
+	; kbkey moves a key waiting in the keyboard latch into the ring buffer. If the buffer is full, the key stays in
+	; the latch until the next call. The simulator has no keyboard, so it leaves kbkey out. Clobbers A and X.
+.if .not .defined(simulator)
+.proc kbkey
+	bit kbd      ; Is a key waiting?
+	bpl done
+	php
+	sei
+	ldx intail
+	inx
+	cpx inhead
+	beq full
+	dex
+	lda kbd
+	sta inbuf,x
+	inx
+	stx intail
+	bit kbdstrb
+full:
+	plp
+done:
+	rts
+.endproc
+.endif
+
+	; kbpoll removes the next byte from the ring buffer and returns it in A with the high bit set. If the buffer is
+	; empty, it returns 0 in A. In both cases the Z flag reflects the value in A.
+.proc kbpoll
+.if .not .defined(simulator)
+	jsr kbkey
+.endif
+	ldx inhead
+	cpx intail
+	beq empty
+	lda inbuf,x
+	inx
+	stx inhead
+	bit inhold   ; Has reception stopped on a full buffer?
+	bmi resume
+ready:
+	ora #$80
+	rts
+resume:
+	pha
+	jsr kbresume
+	pla
+	jmp ready
+empty:
+	lda #0
+	rts
+.endproc
+.export kbpoll
+
+	; kbread copies up to Y bytes from the ring buffer to the address in A (low byte) and X (high byte). It does not
+	; wait for input: the number of bytes copied, which may be zero, is returned in A. Unlike kbpoll and kbgetc, the
+	; copied bytes have their high bit clear.
+.proc kbread
+	sta inptr
+	stx inptr+1
+	sty incnt
+.if .not .defined(simulator)
+	jsr kbkey
+.endif
+	ldy #0
+	ldx inhead
+loop:
+	cpy incnt
+	beq done
+	cpx intail
+	beq done
+	lda inbuf,x
+	and #$7f
+	sta (inptr),y
+	inx
+	iny
+	bne loop
+done:
+	stx inhead
+	bit inhold   ; Has reception stopped on a full buffer?
+	bpl ready
+	jsr kbresume
+ready:
+	tya
+	rts
+.endproc
+.export kbread
+
+	; kbgetc waits for the next byte of input and returns it in A with the high bit set. If nothing is buffered, it
+	; polls the ACIA directly with interrupts masked: this picks up a byte whose interrupt was acknowledged by our own
+	; status read before the processor could take it, and keeps kbgetc working if interrupts are disabled.
+.proc kbgetc
+wait:
+	jsr kbpoll
+	bne done
+	sei
+	lda acsr
+	and #$08
+	beq idle
+	lda acdr
+	cli
+	ora #$80
+done:
+	rts
+idle:
+	cli
+	jmp wait
+.endproc
+.export kbgetc
+
+.segment "BSS"
+	.align 256
+inbuf:
+	.res 256
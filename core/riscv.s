@@ -7,6 +7,7 @@
 
 	; The virtual processor's private state and temporary registers are stored in the low 20 bytes of the zero page.
 	; This includes the virtual program counter, instruction decoding registers, ALU registers, and control registers.
+	; The interrupt-driven input layer in input.s keeps its ring buffer state in the bytes immediately above these.
 	; The user-accessible registers are stored in the upper 128 bytes of the zero page. All multi-byte values are
 	; stored in little-endian format. The virtual processor shares an address space with the actual processor.
 
@@ -15,6 +16,7 @@
 	vf3 = $08 ; vf3 corresponds to the `funct3` field of the RISCV R-, I-, and S-type instruction formats.
 	vs1 = $0c ; vs1 operates as the first operand and 4-byte accumulator for many internal ALU operations.
 	vs2 = $10 ; vs2 operates as the second operand for many internal ALU operations.
+	vfp = $1a ; vfp holds the low 16 bits of the base register of a stack-frame access. It sits above input.s's state.
 
 	; vx0-vx31 correspond to the user-visible RISCV registers x0-x1. The simulator initializes x0 to 0 upon startup
 	; and ensures that simulated instructions never write to it.
@@ -152,6 +154,290 @@
 	sta vx0+96,x
 .endmacro
 
+	; The interpreter can be assembled in one of two profiles. The default profile favors size: every handler returns
+	; through the shared addpc4 and run routines, and instructions in the same group share their decoding code.
+	; Assembling with `-D fast=1` selects the fast profile, which favors speed: the VPC increment and the fetch and
+	; dispatch of the next instruction are inlined at the end of every handler (so dispatch is threaded through the
+	; handlers rather than funneled through run), and the LOAD, STORE, BRANCH, and shift handlers are unrolled per
+	; funct3 so that each variant is selected before any operands are decoded. The fast profile is roughly twice the
+	; size of the default profile.
+.ifndef fast
+	fast = 0
+.endif
+
+	; fetch copies the instruction at the VPC into the instruction register (vin) and jumps to its handler. If we're
+	; targeting the simulator, it also lets the simulator know that we've begun an instruction.
+	;
+	; The copy is done from most- to least-significant byte so that the last load leaves the byte that contains the
+	; opcode in A. We then mask off all but the opcode bits. For RV32I, the low two bits will always be set, so we take
+	; the liberty of ignoring them. Conveniently, the result of the mask is suitable as a branch offset into the
+	; instruction dispatch table.
+.macro fetch
+.if .defined(simulator)
+	lda $e002
+.endif
+	ldy #3
+	lda (vpc),y
+	sta vin+3
+	dey
+	lda (vpc),y
+	sta vin+2
+	dey
+	lda (vpc),y
+	sta vin+1
+	dey
+	lda (vpc),y
+	sta vin
+	and #$7c
+	tax
+	jmp (optab,x)
+.endmacro
+
+	; dispatch ends a handler that has written a new value to the VPC by executing the instruction at the VPC.
+.macro dispatch
+.if fast
+	fetch
+.else
+	jmp run
+.endif
+.endmacro
+
+	; next ends a handler by advancing the VPC to the following instruction and executing it. In the fast profile,
+	; the carry out of the VPC's low byte is rare enough to be left to an out-of-line helper.
+	;
+	; Note that next defines an anonymous label in the fast profile, so forward references to anonymous labels must
+	; not cross it.
+.macro next
+.if fast
+	clc
+	lda vpc
+	adc #4
+	sta vpc
+	bcc :+
+	jsr incvpc
+:
+	fetch
+.else
+	jmp addpc4
+.endif
+.endmacro
+
+	; ldimmi loads the low byte of the sign-extended 12-bit immediate of an I-type instruction into A. On exit, Y holds
+	; the instruction's fourth byte, which the caller needs to form the immediate's second byte.
+	;
+	; Obtaining the sign-extended immediate requires some bit shifting. These shifts are accelerated using the
+	; lsr4/asr4 tables. The result of indexing these tables with a byte value returns the value shifted right or left
+	; by 4 bits, respectively.
+.macro ldimmi
+	ldy vin+2    ; Bits 0-3 of the offset are in the upper 4 bits of the instruction's 3rd byte.
+	lda lsr4,y   ; Shift the instruction's 3rd byte right by 4, moving bits 0-3 of the offset into place.
+	ldy vin+3    ; Bits 4-7 of the offset are in the lower 4 bits of the instruction's 4th byte.
+	ora asl4,y   ; Shift the instruction's 4th byte left by 4 and OR it with A to form the low byte of the offset.
+.endmacro
+
+	; lxea computes the low 16 bits of the effective address of a LOAD instruction into vs1. The address is obtained
+	; by adding the value in the base address register (rs1) and the sign-extended 12-bit immediate present in the
+	; instruction. Because the 65C02 has a 16-bit address space, only the low 16 bits of the effective address are
+	; computed.
+.macro lxea
+	ldars1
+	tax          ; Put the offset of the source register in X.
+	ldimmi
+	adc vx0,x    ; Add the low byte of the offset with the low byte of the base register. ldars1 leaves the carry clear.
+	sta vs1      ; Store the low byte of the effective address into the low byte of vs1.
+	lda lsr4,y   ; Shift the fourth byte of the instruction right by 4, moving bits 8-11 of the offset into place in A.
+	bit vin+3    ; Put the offset's sign bit into N.
+	bpl :+       ; If the sign bit is zero, skip sign extension: bits 12-15 of the offset are already zero.
+	ora #$f0     ; If the sign bit is one, sign extend the offset by setting bits 12-15 to 1.
+:	adc vx0+32,x ; Add the second byte of the offset with the second byte of the base register.
+	sta vs1+1    ; Store the second byte of the effective address into the second byte of vs1.
+.endmacro
+
+	; sxea computes the low 16 bits of the effective address of a STORE instruction into vs1. This is the same as lxea,
+	; but the S-type immediate is split between the rd and funct7 fields of the instruction.
+.macro sxea
+	ldars1
+	tax
+	lda vin+3
+	and #$fe
+	tay
+	lda vin ; extract the store immediate
+	asl
+	lda vin+1
+	and #$0f  ; mask off upper four bits
+	rol
+	ora asl4,y
+	adc vx0,x ; carry is clear from the rol above
+	sta vs1
+	lda lsr4,y
+	bit vin+3
+	bpl :+
+	ora #$f0
+:	adc vx0+32,x
+	sta vs1+1
+.endmacro
+
+	; ldfp is shared by the stack-frame access fast paths below. It copies the low 16 bits of the base register into
+	; vfp if the base register is sp (x2) or s0 (x8), and jumps to fail otherwise. It expects rs1 to be even.
+.macro ldfp fail
+	.local x2, fp
+	lda vin+2    ; rs1[4:1] occupy the low nibble of the instruction's third byte.
+	and #$0f
+	cmp #1
+	beq x2
+	cmp #4
+	bne fail
+	lda vx8
+	ldx vx8+32
+	bcs fp       ; cmp leaves the carry set.
+x2:	lda vx2
+	ldx vx2+32
+fp:	sta vfp
+	stx vfp+1
+.endmacro
+
+	; lxwframe is the fast path for `lw rd, imm(sp)` and `lw rd, imm(s0)`, the stack-frame reloads that make up most of
+	; the loads in compiled code. Rather than computing the effective address, it copies the base register's low 16
+	; bits into vfp and loads through (vfp),y with Y set to the immediate. The immediate must be below 240 so that the
+	; last byte is within reach of Y. It expects to be entered only for lw instructions with an even rs1, and jumps to
+	; slow for anything else (including loads that target x0).
+.macro lxwframe slow
+	.local fail, ok
+	lda vin+3    ; imm[11:4]
+	cmp #$0f
+	bcc ok
+fail:
+	jmp slow
+ok:
+	ldfp fail
+	ldard
+	beq fail
+	tax
+	ldy vin+2
+	lda lsr4,y
+	ldy vin+3
+	ora asl4,y
+	tay
+	lda (vfp),y
+	sta vx0,x
+	iny
+	lda (vfp),y
+	sta vx0+32,x
+	iny
+	lda (vfp),y
+	sta vx0+64,x
+	iny
+	lda (vfp),y
+	sta vx0+96,x
+	next
+.endmacro
+
+	; sxwframe is the store counterpart of lxwframe, for `sw rs2, imm(sp)` and `sw rs2, imm(s0)`. The immediate must be
+	; below 224.
+.macro sxwframe slow
+	.local fail, ok
+	lda vin+3    ; imm[11:5] occupy bits 1-7 of the instruction's fourth byte.
+	cmp #$0e
+	bcc ok
+fail:
+	jmp slow
+ok:
+	ldfp fail
+	lda vin+3
+	and #$fe
+	tay
+	lda vin      ; imm[4:0] occupy the rd field.
+	asl
+	lda vin+1
+	and #$0f
+	rol
+	ora asl4,y
+	tay
+	ldars2
+	tax
+	lda vx0,x
+	sta (vfp),y
+	iny
+	lda vx0+32,x
+	sta (vfp),y
+	iny
+	lda vx0+64,x
+	sta (vfp),y
+	iny
+	lda vx0+96,x
+	sta (vfp),y
+	next
+.endmacro
+
+	; bxtarget adds the sign-extended 13-bit B-type immediate of the executing instruction to the VPC and executes the
+	; instruction at the branch target.
+.macro bxtarget
+	lda vin+3
+	and #$7e
+	bit vin
+	bpl :+
+	ora #$80
+:	tax
+	lda vin+1 ; extract the branch immediate
+	asl
+	and #$1f  ; mask off upper three bits
+	ora asl4,x
+	clc
+	adc vpc
+	sta vpc
+	lda lsr4,x
+	bit vin+3
+	bmi :+
+	adc vpc+1
+	sta vpc+1
+	lda #0
+	adc vpc+2
+	sta vpc+2
+	lda #0
+	adc vpc+3
+	sta vpc+3
+	dispatch
+:	ora #$f0
+	adc vpc+1
+	sta vpc+1
+	lda #$ff
+	adc vpc+2
+	sta vpc+2
+	lda #$ff
+	adc vpc+3
+	sta vpc+3
+	dispatch
+.endmacro
+
+	; link writes the address of the next instruction into rd (unless rd refers to x0).
+.macro link
+	ldard
+	beq :+
+	tax
+	lda vpc
+	adc #4      ; ldard leaves the carry clear
+	sta vx0,x
+	lda vpc+1
+	adc #0
+	sta vx0+32,x
+	lda vpc+2
+	adc #0
+	sta vx0+64,x
+	lda vpc+3
+	adc #0
+	sta vx0+96,x
+:
+.endmacro
+
+.segment "VECTORS"
+	; The vector table is placed at the very start of the image ($0803). Its first entry is the entrypoint; the rest
+	; are the input routines from input.s, which RISC-V programs call via ecall at these fixed addresses.
+	jmp start  ; $0803
+	.import kbpoll, kbread, kbgetc
+	jmp kbpoll ; $0806
+	jmp kbread ; $0809
+	jmp kbgetc ; $080c
+
 .segment "CODE"
 	; start is the entrypoint for the simulator. It is responsible for initializing the simulator's state and running
 	; to the target program.
@@ -182,12 +468,19 @@ tl:	txa
 	sta vx0+64
 	sta vx0+96
 
+	; Start buffering input.
+	.import kbinit
+	jsr kbinit
+
 	; Load the reset vector into the PC and go.
 	.import program
 	lda #<program
 	sta vpc
 	lda #>program
 	sta vpc+1
+	lda #0
+	sta vpc+2
+	sta vpc+3
 	jsr run
 	brk
 .endproc
@@ -199,13 +492,10 @@ tl:	txa
 	; The ALU operations themselves are preceded by two helpers, shift and cltkernel, that are used in the implementation
 	; of various instructions.
 
-	; shift implements the shift loop. It expects the offset from the shiftzero symbol to the shift kernel in A, the
-	; offset of the register that contains the value to shift in Y, the shift amount in vs2, and the offset of the
-	; destination register in X.
-.proc shift
-	; Store the offset into the target.
-	sta tg
-
+	; shiftin copies the value to be shifted from the register at the offset in Y into vs1, then loads the shift amount
+	; from vs2 and masks off its upper 27 bits. If the result is zero, it branches to shift::zero, which simply copies
+	; vs1 to the destination. Otherwise, it leaves the shift amount minus 1 in Y, ready for a shift kernel.
+.macro shiftin
 	; Copy the value to be shifted into vs1. We do this first to free up the Y register.
 	lda vx0,y
 	sta vs1
@@ -216,19 +506,42 @@ tl:	txa
 	lda vx0+96,y
 	sta vs1+3
 
-	; Load the shift amount from vs2 and mask off its upper 27 bits. If the result is zero, simply copy vs1 to the
-	; destination.
 	lda vs2
 	and #$1f
 	beq zero
 
-	; Load the shift amount into Y, decrement it by 1, and branch to the shift kernel.
+	; Load the shift amount into Y and decrement it by 1.
 	tay
 	dey
+.endmacro
+
+	; shift implements the shift loop. It expects the offset from the shiftzero symbol to the shift kernel in A, the
+	; offset of the register that contains the value to shift in Y, the shift amount in vs2, and the offset of the
+	; destination register in X.
+	;
+	; In the fast profile, each kernel instead has its own entry point (sllentry, srlentry, and sraentry), which avoids
+	; patching the branch to the kernel.
+.proc shift
+.if fast
+sllentry:
+	shiftin
+	jmp sll
+srlentry:
+	shiftin
+	jmp srl
+sraentry:
+	shiftin
+	jmp sra
+.else
+	; Store the offset into the target.
+	sta tg
+
+	shiftin
 
 	; These two bytes are "bpl tg". The target is overwritten at the beginning of this procedure to save on code size.
 	.byte $10
 tg:	.byte $00
+.endif
 
 	; For a zero-width shift, simply copy the input to the output.
 zero:
@@ -240,7 +553,7 @@ zero:
 	sta vx0+64,x
 	lda vs1+3
 	sta vx0+96,x
-	jmp addpc4
+	next
 
 	; sll is the shift kernel for an sll instruction. On entry to the kernel, vs1 contains the value to be
 	; shifted, Y contains the shift amount minus 1, and X contains the offset of the destination register.
@@ -268,7 +581,7 @@ slldone:
 	lda vs1+3
 	rol
 	sta vx0+96,x
-	jmp addpc4
+	next
 
 	; sra is the shift kernel for an sra instruction. The contract is the same as that of the other kernels; see
 	; the documentation of sll for more information.
@@ -297,7 +610,7 @@ sradone:
 	lda vs1
 	ror
 	sta vx0,x
-	jmp addpc4
+	next
 
 	; srl is the shift kernel for an srl instruction. The contract is the same as that of the other kernels; see
 	; the documentation of sll for more information.
@@ -323,7 +636,7 @@ srldone:
 	lda vs1
 	ror
 	sta vx0,x
-	jmp addpc4
+	next
 .endproc
 
 	; cltkernel is a shared kernel that computes vx[Y] - vs2 and sets the status flags accordingly. This is used by the
@@ -350,23 +663,27 @@ srldone:
 	bit vin
 	bne cksub
 	aluop adc  ; carry is clear from the ALU dispatcher
-	jmp addpc4
+	next
 cksub:
 	bit vin+3
 	bne sub
 	aluop adc  ; carry is clear from the ALU dispatcher
-	jmp addpc4
+	next
 sub:
 	sec
 	aluop sbc
-	jmp addpc4
+	next
 .endproc
 
 	; alusll implements the sll instruction. Essentially all of the work is done by the shift helper.
 .proc alusll
 	tax
+.if fast
+	jmp shift::sllentry
+.else
 	lda #shift::sll-shift::zero
 	jmp shift
+.endif
 .endproc
 
 	; alusltu implements the sltu and sltui instructions. The result is computed by subtracting the second operand
@@ -385,7 +702,7 @@ setrd:
 	sta vx0+32,x
 	sta vx0+64,x
 	sta vx0+96,x
-	jmp addpc4
+	next
 .endproc
 
 	; aluslt implements the slt and slti instructions. The result is computed by subtracting the second operand (vs2)
@@ -408,7 +725,7 @@ setrd:
 .proc aluxor
 	tax
 	aluop eor
-	jmp addpc4
+	next
 .endproc
 
 	; alusrlsra implements the srl, srli, sra, and srai instructions. The first operand is shifted by the amount
@@ -427,8 +744,12 @@ srl:
 	and #$1f
 	cmp #$1f
 	beq srl31
+.if fast
+	jmp shift::srlentry
+.else
 	lda #shift::srl-shift::zero
 	jmp shift
+.endif
 srl31:
 	lda vx0+96,y
 	asl          ; Put the high bit of the source register into C
@@ -438,15 +759,19 @@ srl31:
 	sta vx0+32,x
 	rol          ; Put the high bit of the source register into the low bit of the accumulator
 	sta vx0,x    ; Store the accumulator into the low byte of the destination register
-	jmp addpc4
+	next
 
 sra:
 	lda vs2
 	and #$1f
 	cmp #$1f
 	beq sra31
+.if fast
+	jmp shift::sraentry
+.else
 	lda #shift::sra-shift::zero
 	jmp shift
+.endif
 sra31:
 	; The result of a 31-bit arithmetic right shift is either zero (if the value in the source register is positive)
 	; or (1<<32)-1 (if the value is negative). In both cases, all of the bytes of the destination register will hold
@@ -468,54 +793,30 @@ sra31:
 	sta vx0+64,x
 	sta vx0+32,x
 	sta vx0,x
-	jmp addpc4
+	next
 .endproc
 
 	; aluor implements the or and ori instructions.
 .proc aluor
 	tax
 	aluop ora
-	jmp addpc4
+	next
 .endproc
 
 	; aluand implements the and and andi instructions.
 .proc aluand
 	tax
 	aluop and
-	jmp addpc4
+	next
 .endproc
 
 	; run is the main loop of the simulator. It is responsible for fetching the next instruction to execute, decoding
-	; its opcode field, and dispatching exeucution to the correct handler.
+	; its opcode field, and dispatching exeucution to the correct handler. In the fast profile, handlers dispatch the
+	; next instruction themselves, so run is only used to start execution and by a few rare paths.
 	;
 	; The speed of the simulator depends on this loop being as tight as possible.
 .proc run
-	; If we're targeting the simulator, let it know we've begun an instruction.
-.if .defined(simulator)
-	lda $e002
-.endif
-
-	; Otherwise. copy the next instruction to execute into the instruction register (vin). This copy is done from most-
-	; to least-significant byte so that the last load leaves the byte that contains the opcode in A.
-	ldy #3
-	lda (vpc),y
-	sta vin+3
-	dey
-	lda (vpc),y
-	sta vin+2
-	dey
-	lda (vpc),y
-	sta vin+1
-	dey
-	lda (vpc),y
-	sta vin
-
-	; Mask off all but the opcode bits. For RV32I, the low two bits will always be set, so we take the liberty of
-	; ignoring them. Conveniently, the result of the mask is suitable as a branch offset into the instruction dispatch
-	; table.
-	and #$7c
-	tax
-	jmp (optab,x)
+	fetch
 .endproc
 
 	; addpc4 increments the virtual program counter by 4 bytes. In order to save cycles, each byte of the add is only
@@ -542,6 +843,20 @@ sra31:
 	jmp run
 .endproc
 
+.if fast
+	; incvpc propagates a carry out of the low byte of the VPC into its upper three bytes. It is used by next in the
+	; fast profile.
+.proc incvpc
+	inc vpc+1
+	bne done
+	inc vpc+2
+	bne done
+	inc vpc+3
+done:
+	rts
+.endproc
+.endif
+
 	; Below here is where things really start to get interesting. The code that follows implements most of the
 	; instruction-format-specific decoding as well as most of the operand-specific behaviors.
 
@@ -550,61 +865,8 @@ sra31:
 	rts
 .endproc
 
-	; oplx implements the LOAD group. This includes the lw, lh, lhu, lb, and lbu instructions. As per the RISC-V spec,
-	; LOAD instructions are encoded using the I-type instruction format. The funct3 field indicates the width and
-	; sign-extension behavior of the load. This field is extracted and used as the index into a jump table to transfer
-	; control to the appropriate load kernel. Each kernel is implemented as an unrolled loop. Loads that target x0 are
-	; special-cased: though the load must execute, it must not write to the vx0 virtual register. These loads do not
-	; use the jump table, and instead use a load width table and a loop.
-	;
-	; The first part of this procedure is concerned with calculating the effective address for the load. This address
-	; is obtained by adding the value in the base address register (rs1) and the sign-extended 12-bit immediate present
-	; in the instruction. Because the 65C02 has a 16-bit address space, only the low 16 bits of the effective address
-	; are computed. The effective address is stored in vs1.
-	;
-	; Obtaining the sign-extended immediate requires some bit shifting. These shifts are accelerated using the
-	; lsr4/asr4 tables. The result of indexing these tables with a byte value returns the value shifted right or left
-	; by 4 bits, respectively.
-.proc oplx
-	ldars1
-	tax          ; Put the offset of the source register in X.
-	ldy vin+2    ; Bits 0-3 of the offset are in the upper 4 bits of the instruction's 3rd byte.
-	lda lsr4,y   ; Shift the instruction's 3rd byte right by 4, moving bits 0-3 of the offset into place.
-	ldy vin+3    ; Bits 4-7 of the offset are in the lower 4 bits of the instruction's 4th byte.
-	ora asl4,y   ; Shift the instruction's 4th byte left by 4 and OR it with A to form the low byte of the offset.
-	adc vx0,x    ; Add the low byte of the offset with the low byte of the base register. ldars1 leaves the carry clear.
-	sta vs1      ; Store the low byte of the effective address into the low byte of vs1.
-	lda lsr4,y   ; Shift the fourth byte of the instruction right by 4, moving bits 8-11 of the offset into place in A.
-	bit vin+3    ; Put the offset's sign bit into N.
-	bpl s0       ; If the sign bit is zero, skip sign extension: bits 12-15 of the offset are already zero.
-	ora #$f0     ; If the sign bit is one, sign extend the offset by setting bits 12-15 to 1.
-s0:	adc vx0+32,x ; Add the second byte of the offset with the second byte of the base register.
-	sta vs1+1    ; Store the second byte of the effective address into the second byte of vs1.
-	lda vin+1    ; Put funct3 into A, then shift and mask it to form the jump/width table index.
-	lsr
-	lsr
-	lsr
-	and #$0e
-	tax              ; Put the table index into X.
-	ldard            ; Load the offset of the destination register into A.
-	beq nw           ; If the destination register is x0, branch to the load-only loop.
-	jmp (jlxtable,x) ; Otherwise, jump to the appropriate load kernel.
-
-nw:
-	; We still need to perform the load when the destination register is x0, as the load may have side effects.
-	; This is rare enough in practice that it's not worth using load kernels: instead, we use a table that maps the
-	; width field to the number of bytes we need to load and loop.
-	lda jnwtable,x
-	tax
-	ldy #0
-rl:	lda (vs1),y
-	iny
-	dex
-	bne rl
-	jmp addpc4
-
-lxw:
-	tax
+	; The load kernels. Each expects the effective address in vs1 and the offset of the destination register in X.
+.macro lxwk
 	ldy #3
 	lda (vs1),y
 	sta vx0+96,x
@@ -617,10 +879,10 @@ lxw:
 	dey
 	lda (vs1),y
 	sta vx0,x
-	jmp addpc4
+	next
+.endmacro
 
-lxh:
-	tax
+.macro lxhk
 	ldy #1
 	lda (vs1),y
 	sta vx0+32,x
@@ -628,26 +890,26 @@ lxh:
 	dey
 	lda (vs1),y
 	sta vx0,x
-	bcc s1
+	bcc :+
 	dey
-s1:	sty vx0+64,x
+:	sty vx0+64,x
 	sty vx0+96,x
-	jmp addpc4
+	next
+.endmacro
 
-lxb:
-	tax
+.macro lxbk
 	ldy #0
 	lda (vs1),y
 	sta vx0,x
-	bpl s2
+	bpl :+
 	dey
-s2:	sty vx0+32,x
+:	sty vx0+32,x
 	sty vx0+64,x
 	sty vx0+96,x
-	jmp addpc4
+	next
+.endmacro
 
-lxhu:
-	tax
+.macro lxhuk
 	ldy #1
 	lda (vs1),y
 	sta vx0+32,x
@@ -656,27 +918,168 @@ lxhu:
 	sta vx0,x
 	sty vx0+64,x
 	sty vx0+96,x
-	jmp addpc4
+	next
+.endmacro
 
-lxbu:
-	tax
+.macro lxbuk
 	ldy #0
 	lda (vs1),y
 	sta vx0,x
 	sty vx0+32,x
 	sty vx0+64,x
 	sty vx0+96,x
+	next
+.endmacro
+
+	; oplx implements the LOAD group. This includes the lw, lh, lhu, lb, and lbu instructions. As per the RISC-V spec,
+	; LOAD instructions are encoded using the I-type instruction format. The funct3 field indicates the width and
+	; sign-extension behavior of the load. This field is extracted and used as the index into a jump table to transfer
+	; control to the appropriate load kernel. Each kernel is implemented as an unrolled loop. Loads that target x0 are
+	; special-cased: though the load must execute, it must not write to the vx0 virtual register. These loads do not
+	; use the jump table, and instead use a load width table and a loop.
+	;
+	; The first part of this procedure is concerned with calculating the effective address for the load, which lxea
+	; stores in vs1.
+.proc oplx
+.if fast
+	; In the fast profile, funct3 and the low bit of rs1 select the load kernel before anything else is decoded. Each
+	; kernel computes the effective address and performs its load inline. Word loads with an even rs1 try the
+	; stack-frame fast path first.
+	lda vin+1
+	lsr
+	lsr
+	lsr
+	and #$1e
+	tax
+	jmp (jlxtable,x)
+
+lxwf:
+	lxwframe lxw
+
+lxw:
+	lxea
+	ldard
+	beq lxwnw
+	tax
+	lxwk
+lxwnw:
+	ldy #3
+	jmp nw
+
+lxh:
+	lxea
+	ldard
+	beq lxhnw
+	tax
+	lxhk
+lxhnw:
+	ldy #1
+	jmp nw
+
+lxb:
+	lxea
+	ldard
+	beq lxbnw
+	tax
+	lxbk
+lxbnw:
+	ldy #0
+	jmp nw
+
+lxhu:
+	lxea
+	ldard
+	beq lxhunw
+	tax
+	lxhuk
+lxhunw:
+	ldy #1
+	jmp nw
+
+lxbu:
+	lxea
+	ldard
+	beq lxbunw
+	tax
+	lxbuk
+lxbunw:
+	ldy #0
+	jmp nw
+
+	; Loads that target x0 are rare, so they share a loop that expects the offset of the last byte to load in Y and
+	; returns through addpc4 rather than inlining the dispatch.
+nw:	lda (vs1),y
+	dey
+	bpl nw
 	jmp addpc4
+.else
+	lda vin+1    ; Word loads with an even rs1 try the stack-frame fast path first.
+	and #$f0
+	cmp #$20
+	bne ea
+	lxwframe ea
+
+ea:
+	lxea
+	lda vin+1    ; Put funct3 into A, then shift and mask it to form the jump/width table index.
+	lsr
+	lsr
+	lsr
+	and #$0e
+	tax              ; Put the table index into X.
+	ldard            ; Load the offset of the destination register into A.
+	beq nw           ; If the destination register is x0, branch to the load-only loop.
+	jmp (jlxtable,x) ; Otherwise, jump to the appropriate load kernel.
+
+nw:
+	; We still need to perform the load when the destination register is x0, as the load may have side effects.
+	; This is rare enough in practice that it's not worth using load kernels: instead, we use a table that maps the
+	; width field to the number of bytes we need to load and loop.
+	lda jnwtable,x
+	tax
+	ldy #0
+rl:	lda (vs1),y
+	iny
+	dex
+	bne rl
+	jmp addpc4
+
+lxw:
+	tax
+	lxwk
+
+lxh:
+	tax
+	lxhk
+
+lxb:
+	tax
+	lxbk
+
+lxhu:
+	tax
+	lxhuk
+
+lxbu:
+	tax
+	lxbuk
 
-jlxtable:
-	.word lxb, lxh, lxw, lxw, lxbu, lxhu
 jnwtable:
 	.byte 1, 2, 4, 4, 2, 1
+.endif
+
+jlxtable:
+.if fast
+	.word lxb, lxh, lxwf, lxw, lxbu, lxhu, opinv, opinv ; rs1 even
+	.word lxb, lxh, lxw, lxw, lxbu, lxhu, opinv, opinv  ; rs1 odd
+.else
+	.word lxb, lxh, lxw, lxw, lxbu, lxhu
+.endif
 .endproc
 
 	; opfence implements the MISC-MEM group.
 .proc opfence
-	jmp addpc4
+	next
 .endproc
 
 	; opimm implementds the OP-IMM group.
@@ -714,7 +1117,7 @@ bz:	sta vs2+3 ; imm[3] = fill
 	jmp (alutab,x)
 
 skip:
-	jmp addpc4
+	next
 .endproc
 
 	; opauipc implements the auipc instruction.
@@ -735,41 +1138,11 @@ skip:
 	adc vpc+3
 	sta vx0+96,x
 skip:
-	jmp addpc4
+	next
 .endproc
 
-	; opsx implements the STORE group.
-.proc opsx
-	ldars1
-	tax
-	lda vin+3
-	and #$fe
-	tay
-	lda vin ; extract the store immediate
-	asl
-	lda vin+1
-	and #$0f  ; mask off upper four bits
-	rol
-	ora asl4,y
-	adc vx0,x ; carry is clear from the rol above
-	sta vs1
-	lda lsr4,y
-	bit vin+3
-	bpl s0
-	ora #$f0
-s0:	adc vx0+32,x
-	sta vs1+1
-	lda vin+1 ; extract funct3
-	lsr
-	lsr
-	lsr
-	and #$0e
-	tax
-	ldy #0
-	ldars2
-	jmp (jsxtable,x)
-sxw:
-	tax
+	; The store kernels. Each expects the effective address in vs1, 0 in Y, and the offset of the source register in X.
+.macro sxwk
 	lda vx0,x
 	sta (vs1),y
 	iny
@@ -781,23 +1154,92 @@ sxw:
 	iny
 	lda vx0+96,x
 	sta (vs1),y
-	jmp addpc4
-sxh:
-	tax
+	next
+.endmacro
+
+.macro sxhk
 	lda vx0,x
 	sta (vs1),y
 	iny
 	lda vx0+32,x
 	sta (vs1),y
-	jmp addpc4
-sxb:
-	tax
+	next
+.endmacro
+
+.macro sxbk
 	lda vx0,x
 	sta (vs1),y
-	jmp addpc4
+	next
+.endmacro
+
+	; opsx implements the STORE group.
+.proc opsx
+.if fast
+	; In the fast profile, funct3 and the low bit of rs1 select the store kernel before the effective address is
+	; computed. Word stores with an even rs1 try the stack-frame fast path first.
+	lda vin+1 ; extract funct3 and rs1[0]
+	lsr
+	lsr
+	lsr
+	and #$1e
+	tax
+	jmp (jsxtable,x)
+sxwf:
+	sxwframe sxw
+sxw:
+	sxea
+	ldy #0
+	ldars2
+	tax
+	sxwk
+sxh:
+	sxea
+	ldy #0
+	ldars2
+	tax
+	sxhk
+sxb:
+	sxea
+	ldy #0
+	ldars2
+	tax
+	sxbk
+.else
+	lda vin+1 ; Word stores with an even rs1 try the stack-frame fast path first.
+	and #$f0
+	cmp #$20
+	bne ea
+	sxwframe ea
+
+ea:
+	sxea
+	lda vin+1 ; extract funct3
+	lsr
+	lsr
+	lsr
+	and #$0e
+	tax
+	ldy #0
+	ldars2
+	jmp (jsxtable,x)
+sxw:
+	tax
+	sxwk
+sxh:
+	tax
+	sxhk
+sxb:
+	tax
+	sxbk
+.endif
 
 jsxtable:
+.if fast
+	.word sxb, sxh, sxwf, opinv, opinv, opinv, opinv, opinv ; rs1 even
+	.word sxb, sxh, sxw, opinv, opinv, opinv, opinv, opinv  ; rs1 odd
+.else
 	.word sxb, sxh, sxw
+.endif
 .endproc
 
 	; opop implements the OP group.
@@ -830,11 +1272,124 @@ jsxtable:
 	lda vin+3
 	sta vx0+96,x
 skip:
-	jmp addpc4
+	next
 .endproc
 
+	; bxregs loads the offsets of the registers to compare for a branch into Y (rs1) and X (rs2).
+.macro bxregs
+	ldars1
+	tay
+	ldars2
+	tax
+.endmacro
+
+	; bxsub subtracts the branch's second operand from its first, leaving the flags from the high byte in P.
+.macro bxsub
+	sec
+	lda vx0,y
+	sbc vx0,x
+	lda vx0+32,y
+	sbc vx0+32,x
+	lda vx0+64,y
+	sbc vx0+64,x
+	lda vx0+96,y
+	sbc vx0+96,x
+.endmacro
+
+	; bxfast is the body of opbxx in the fast profile. funct3 selects a handler for each branch condition, and
+	; branches that are not taken continue to the next instruction inline.
+.macro bxfast
+	lda vin+1
+	lsr
+	lsr
+	lsr
+	and #$0e
+	tax
+	jmp (jbxtable,x)
+
+bxeq:
+	bxregs
+	lda vx0,y
+	cmp vx0,x
+	bne :+
+	lda vx0+32,y
+	cmp vx0+32,x
+	bne :+
+	lda vx0+64,y
+	cmp vx0+64,x
+	bne :+
+	lda vx0+96,y
+	cmp vx0+96,x
+	bne :+
+	jmp taken
+:
+	next
+
+bxne:
+	bxregs
+	lda vx0,y
+	cmp vx0,x
+	bne net
+	lda vx0+32,y
+	cmp vx0+32,x
+	bne net
+	lda vx0+64,y
+	cmp vx0+64,x
+	bne net
+	lda vx0+96,y
+	cmp vx0+96,x
+	bne net
+	next
+net:	jmp taken
+
+bxlt:
+	bxregs
+	bxsub
+	bvc :+
+	eor #$80  ; The first operand is less than the second if N != V.
+:	bpl :+
+	jmp taken
+:
+	next
+
+bxge:
+	bxregs
+	bxsub
+	bvc :+
+	eor #$80
+:	bmi :+
+	jmp taken
+:
+	next
+
+bxltu:
+	bxregs
+	bxsub
+	bcs :+
+	jmp taken
+:
+	next
+
+bxgeu:
+	bxregs
+	bxsub
+	bcc :+
+	jmp taken
+:
+	next
+
+taken:
+	bxtarget
+
+jbxtable:
+	.word bxeq, bxne, opinv, opinv, bxlt, bxge, bxltu, bxgeu
+.endmacro
+
 	; opbxx implements the BRANCH group.
 .proc opbxx
+.if fast
+	bxfast
+.else
 	ldars1
 	tay
 	ldars2
@@ -892,67 +1447,43 @@ s0:	sec
 t2:	eor vf3
 	and #$10
 	bne b0
-	jmp addpc4
-b0:	lda vin+3
-	and #$7e
-	bit vin
-	bpl s2
-	ora #$80
-s2:	tax
-	lda vin+1 ; extract the branch immediate
-	asl
-	and #$1f  ; mask off upper three bits
-	ora asl4,x
-	clc
-	adc vpc
-	sta vpc
-	lda lsr4,x
-	bit vin+3
-	bmi sx
-	adc vpc+1
-	sta vpc+1
-	lda #0
-	adc vpc+2
-	sta vpc+2
-	lda #0
-	adc vpc+3
-	sta vpc+3
-	jmp run
-sx:	ora #$f0
-	adc vpc+1
-	sta vpc+1
-	lda #$ff
-	adc vpc+2
-	sta vpc+2
-	lda #$ff
-	adc vpc+3
-	sta vpc+3
-	jmp run
+	next
+b0:
+	bxtarget
+.endif
 .endproc
 
-	; jalrd is a helper that writes the address of the next instruction into rd (unless rd referes to x0)
+	; jalrd is a helper that writes the address of the next instruction into rd (unless rd referes to x0). The fast
+	; profile uses the link macro inline instead.
 .proc jalrd
-	ldard
-	beq skip
-	tax
-	lda vpc
-	adc #4      ; ldard leaves the carry clear
-	sta vx0,x
-	lda vpc+1
-	adc #0
-	sta vx0+32,x
-	lda vpc+2
-	adc #0
-	sta vx0+64,x
-	lda vpc+3
-	adc #0
-	sta vx0+96,x
-skip:	
+	link
 	rts
 .endproc
 
+	; opjalr implements the jalr instruction. `jalr x0, 0(ra)` (ret) is special-cased: its target is the low 16 bits of
+	; ra, and as with opjal's call and jump cases the upper bytes of the VPC are left alone.
 .proc opjalr
+	lda vin+3    ; imm[11:4]
+	ora vin+2    ; imm[3:0] and rs1[4:1]
+	bne jalr
+	lda vin+1    ; rs1[0], funct3, and rd[4:1]
+	cmp #$80
+	bne jalr
+	bit vin      ; rd[0]
+	bmi jalr
+	lda vx1
+	and #$fe
+	sta vpc
+	lda vx1+32
+	sta vpc+1
+	dispatch
+
+jalr:
+.if fast
+	link
+.else
 	jsr jalrd
+.endif
 	ldars1
 	tax
 	ldy vin+2
@@ -972,7 +1503,7 @@ skip:
 	lda #0     ; immediate byte 4 in a
 	adc vx0+96,x
 	sta vpc+3
-	jmp run
+	dispatch
 s0:	ora #$f0   ; immediate byte 2 in a
 	adc vx0+32,x
 	sta vpc+1
@@ -982,11 +1513,13 @@ s0:	ora #$f0   ; immediate byte 2 in a
 	lda #$ff   ; immediate byte 4 in a
 	adc vx0+96,x
 	sta vpc+3
-	jmp run
+	dispatch
 .endproc
 
-.proc opjal
-	jsr jalrd ; pc+4 -> rd
+	; jallo adds the low 16 bits of the J-type immediate of the executing instruction to the low 16 bits of the VPC.
+	; On exit, the carry holds the carry out of the VPC's second byte, and Y holds the instruction's fourth byte with
+	; its sign bit masked off.
+.macro jallo
 	lda vin+2
 	tax
 	and #$10
@@ -1006,6 +1539,38 @@ s0:	ora #$f0   ; immediate byte 2 in a
 	ora lsr4,y ; immediate byte 2 in a
 	adc vpc+1
 	sta vpc+1
+.endmacro
+
+	; opjal implements the jal instruction. The two forms that compilers emit most, `jal ra, off` (call) and
+	; `jal x0, off` (jump), are special-cased. The 65C02 can only fetch instructions from the low 64K, so the upper two
+	; bytes of the VPC are always zero for a running program: these cases only add the low 16 bits of the immediate,
+	; and a call writes constant zeroes to the upper bytes of ra instead of propagating the carry through them.
+.proc opjal
+	lda vin+1  ; rd[4:1]
+	and #$0f
+	bne jal
+	bit vin    ; rd[0]
+	bpl jump
+	clc        ; pc+4 -> ra
+	lda vpc
+	adc #4
+	sta vx1
+	lda vpc+1
+	adc #0
+	sta vx1+32
+	stz vx1+64
+	stz vx1+96
+jump:
+	jallo
+	dispatch
+
+jal:
+.if fast
+	link      ; pc+4 -> rd
+.else
+	jsr jalrd ; pc+4 -> rd
+.endif
+	jallo
 	lda vin+2
 	and #$0f
 	bit vin+3
@@ -1015,14 +1580,14 @@ s0:	ora #$f0   ; immediate byte 2 in a
 	lda #0     ; immediate byte 4 in a
 	adc vpc+3
 	sta vpc+3
-	jmp run
+	dispatch
 s0:	ora #$f0   ; immediate byte 3 in a
 	adc vpc+2
 	sta vpc+2
 	lda #$ff   ; immediate byte 4 in a
 	adc vpc+3
 	sta vpc+3
-	jmp run
+	dispatch
 .endproc
 
 .proc opsystem
@@ -1044,7 +1609,7 @@ tg:	.byte $00,$00
 	php
 	pla
 	sta vx10+96
-	jmp addpc4
+	next
 .endproc
 
 .segment "BSS"
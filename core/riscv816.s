@@ -0,0 +1,956 @@
+	; rixty816: a RISCV interpreter for the 65C816
+	;
+	; This is a variant of the 65C02 interpreter in riscv.s for 65C816-class machines such as the Apple IIgs. It runs
+	; in native mode with 16-bit accumulator and index registers, so each 32-bit RISC-V ALU operation takes two
+	; accumulator operations instead of four, and each instruction fetch takes two 16-bit loads. Effective addresses
+	; are 24 bits wide and all loads and stores go through [dp],y long indirection, so RISC-V programs are not limited to
+	; bank 0. The decoding tricks below are the 16-bit equivalents of those in riscv.s; see that file for the details of
+	; the RISC-V instruction formats.
+	;
+	; Reference will be made throughout to the RISC-V Instruction Set Manual Volume I, Version 2.2.
+
+	; The virtual processor's private state occupies the same zero page locations as it does in riscv.s, so input.s can
+	; be shared between the two interpreters. The direct page register is always 0.
+
+	vpc = $00 ; The virtual program counter. Its low three bytes form a long pointer to the executing instruction.
+	vin = $04 ; The virtual instruction register holds the currently executing RISCV instruction.
+	vs1 = $0c ; vs1 holds effective addresses and the value being shifted by the shift kernels.
+	vs2 = $10 ; vs2 operates as the second operand for many internal ALU operations.
+
+	; vx0-vx31 correspond to the user-visible RISCV registers x0-x31. As in riscv.s, the simulator initializes x0 to 0
+	; upon startup and ensures that simulated instructions never write to it.
+	;
+	; The virtual register file is organized into two 16-bit planes. Plane 0 ($80-$bf) contains the low half of every
+	; virtual register and plane 1 ($c0-$ff) the high half. Register xN is accessed at vx0+N*2 and vx0+64+N*2, so the
+	; register offsets computed by ldard, ldars1, and ldars2 are the register numbers scaled by two.
+	vx0 = $80
+
+	; ldard loads the value of the rd field of the R-, I-, and U-type instruction formats, scaled by two, into A. The Z
+	; flag is set if rd refers to x0.
+	;
+	; rd occupies bits 7-11 of the instruction. Shifting the instruction's low word left by two moves rd to bits 9-13,
+	; and swapping the accumulator's bytes moves it to bits 1-5.
+.macro ldard
+	lda vin
+	asl
+	asl
+	xba
+	and #$003e
+.endmacro
+
+	; ldars1 loads the value of the rs1 field, scaled by two, into A. rs1 occupies bits 7-11 of the word at vin+1, so
+	; this is the same as ldard.
+.macro ldars1
+	lda vin+1
+	asl
+	asl
+	xba
+	and #$003e
+.endmacro
+
+	; ldars2 loads the value of the rs2 field, scaled by two, into A. rs2 occupies bits 4-8 of the word at vin+2.
+.macro ldars2
+	lda vin+2
+	lsr
+	lsr
+	lsr
+	and #$003e
+.endmacro
+
+	; ldf3 loads the value of the funct3 field, scaled by two, into A. The result is suitable for indexing a jump table.
+	; funct3 occupies bits 4-6 of the word at vin+1.
+.macro ldf3
+	lda vin+1
+	lsr
+	lsr
+	lsr
+	and #$000e
+.endmacro
+
+	; asr4 shifts A right by four bits, replicating its sign bit.
+.macro asr4
+	cmp #$8000
+	ror
+	cmp #$8000
+	ror
+	cmp #$8000
+	ror
+	cmp #$8000
+	ror
+.endmacro
+
+	; ldimmi loads the low 16 bits of the sign-extended 12-bit immediate of an I-type instruction into A. The immediate
+	; occupies the upper 12 bits of the word at vin+2, so an arithmetic shift does all of the work. On exit, the N flag
+	; holds the immediate's sign.
+.macro ldimmi
+	lda vin+2
+	asr4
+.endmacro
+
+	; aluop performs a four-byte ALU operation using the given ALU opcode. Source 1 is the virtual register at the offset
+	; in Y, source 2 is vs2, and the destination is the virtual register at the offset in X.
+.macro aluop opc
+	lda vx0,y
+	opc vs2
+	sta vx0,x
+	lda vx0+64,y
+	opc vs2+2
+	sta vx0+64,x
+.endmacro
+
+	; addea adds the sign-extended immediate in A to the base register at the offset in X and stores the resulting
+	; effective address in vs1. It expects the immediate's sign in N.
+.macro addea
+	bmi :+
+	clc
+	adc vx0,x
+	sta vs1
+	lda vx0+64,x
+	adc #0
+	bra :++
+:	clc
+	adc vx0,x
+	sta vs1
+	lda vx0+64,x
+	adc #$ffff
+:	sta vs1+2
+.endmacro
+
+	; fetch copies the instruction at the VPC into the instruction register (vin) and jumps to its handler. If we're
+	; targeting the simulator, it also lets the simulator know that we've begun an instruction.
+.macro fetch
+.if .defined(simulator)
+	lda $e002
+.endif
+	ldy #2
+	lda [vpc],y
+	sta vin+2
+	lda [vpc]
+	sta vin
+	and #$007c
+	tax
+	jmp (optab,x)
+.endmacro
+
+	; next ends a handler by advancing the VPC to the following instruction and executing it.
+.macro next
+	jmp addpc4
+.endmacro
+
+	; dispatch ends a handler that has written a new value to the VPC by executing the instruction at the VPC.
+.macro dispatch
+	jmp run
+.endmacro
+
+	; link writes the address of the next instruction into rd (unless rd refers to x0).
+.macro link
+	ldard
+	beq :+
+	tax
+	clc
+	lda vpc
+	adc #4
+	sta vx0,x
+	lda vpc+2
+	adc #0
+	sta vx0+64,x
+:
+.endmacro
+
+.segment "VECTORS"
+	; The vector table is identical to the one in riscv.s.
+	jmp start  ; $0803
+	.import kbpoll, kbread, kbgetc
+	jmp kbpoll ; $0806
+	jmp kbread ; $0809
+	jmp kbgetc ; $080c
+
+.segment "CODE"
+	; start is the entrypoint for the simulator. It is entered in emulation mode, starts buffering input, switches to
+	; native mode with 16-bit registers, and runs the target program. When the program halts, it returns to emulation
+	; mode.
+.proc start
+	.a8
+	.i8
+	.import kbinit
+	jsr kbinit
+
+	clc
+	xce
+	rep #$30
+	.a16
+	.i16
+
+	; Set vx0 to 0.
+	stz vx0
+	stz vx0+64
+
+	; Load the reset vector into the PC and go.
+	.import program
+	lda #program
+	sta vpc
+	stz vpc+2
+	jsr run
+	sec
+	xce
+	brk
+.endproc
+.export start
+
+	; nirq is the native mode interrupt handler. It saves the full 16-bit registers and enters input.s's kbirq with
+	; 8-bit registers, using a fake interrupt frame so that kbirq's rti returns here.
+.proc nirq
+	rep #$30
+	.a16
+	.i16
+	pha
+	phx
+	phy
+	sep #$30
+	.a8
+	.i8
+	.import kbirq
+	phk
+	pea done
+	php
+	jmp kbirq
+done:
+	rep #$30
+	.a16
+	.i16
+	ply
+	plx
+	pla
+	rti
+.endproc
+.export nirq
+
+	; The ALU operations expect the offset of their first operand in Y, the value of their second operand in vs2, and
+	; the offset of their destination register in X.
+
+	; shiftin copies the value to be shifted from the register at the offset in Y into vs1, then loads the shift amount
+	; from vs2 into Y. Z is set if the shift amount is zero.
+.macro shiftin
+	lda vx0,y
+	sta vs1
+	lda vx0+64,y
+	sta vs1+2
+	lda vs2
+	and #$001f
+	tay
+.endmacro
+
+	; shift contains the shift kernels. Shifts by 16 or more bits begin by moving one half of vs1 to the other, so no
+	; kernel loops more than 15 times. Each loop keeps one half of the value in A.
+.proc shift
+sll:
+	shiftin
+	beq out
+	cpy #16
+	bcc sllsmall
+	lda vs1
+	sta vs1+2
+	stz vs1
+	tya
+	sbc #16      ; cpy leaves the carry set
+	beq out
+	tay
+sllsmall:
+	lda vs1
+sllloop:
+	asl
+	rol vs1+2
+	dey
+	bne sllloop
+	sta vs1
+	bra out
+
+srl:
+	shiftin
+	beq out
+	cpy #16
+	bcc srlsmall
+	lda vs1+2
+	sta vs1
+	stz vs1+2
+	tya
+	sbc #16
+	beq out
+	tay
+srlsmall:
+	lda vs1+2
+srlloop:
+	lsr
+	ror vs1
+	dey
+	bne srlloop
+	sta vs1+2
+
+out:
+	lda vs1
+	sta vx0,x
+	lda vs1+2
+	sta vx0+64,x
+	next
+
+sra:
+	shiftin
+	beq out
+	cpy #16
+	bcc srasmall
+	lda vs1+2
+	sta vs1
+	asl          ; Put the sign bit into C and fill the high half with it.
+	lda #0
+	bcc :+
+	dec a
+:	sta vs1+2
+	tya
+	sec
+	sbc #16
+	beq out
+	tay
+srasmall:
+	lda vs1+2
+sraloop:
+	cmp #$8000   ; Put the high-order bit of vs1 into C.
+	ror
+	ror vs1
+	dey
+	bne sraloop
+	sta vs1+2
+	bra out
+.endproc
+
+	; cltkernel computes vx[Y] - vs2 and sets the status flags accordingly. This is used by the implementation of the
+	; slt and sltu instructions.
+.proc cltkernel
+	sec
+	lda vx0,y
+	sbc vs2
+	lda vx0+64,y
+	sbc vs2+2
+	rts
+.endproc
+
+	; aluaddsub implements the addi, add, and sub instructions. If bit 5 of the instruction is clear, it is an addi. If
+	; bit 5 is set and bit 30 is clear, it is an add. Otherwise, it is a sub.
+.proc aluaddsub
+	tax
+	lda #$0060
+	bit vin
+	beq add
+	bit vin+3
+	bne sub
+add:
+	clc
+	aluop adc
+	next
+sub:
+	sec
+	aluop sbc
+	next
+.endproc
+
+	; alusll implements the sll and slli instructions.
+.proc alusll
+	tax
+	jmp shift::sll
+.endproc
+
+	; alusltu implements the sltu and sltiu instructions. The first operand is less than the second if the subtraction
+	; borrows.
+.proc alusltu
+	tax
+	jsr cltkernel
+	lda #0
+	rol
+	eor #1
+setrd:
+	sta vx0,x
+	stz vx0+64,x
+	next
+.endproc
+
+	; aluslt implements the slt and slti instructions. The first operand is less than the second if N != V after the
+	; subtraction.
+.proc aluslt
+	tax
+	jsr cltkernel
+	bvc :+
+	eor #$8000
+:	asl          ; Put N xor V into C.
+	lda #0
+	rol
+	jmp alusltu::setrd
+.endproc
+
+	; aluxor implements the xor and xori instructions.
+.proc aluxor
+	tax
+	aluop eor
+	next
+.endproc
+
+	; alusrlsra implements the srl, srli, sra, and srai instructions. If bit 30 of the instruction is set, an arithmetic
+	; shift is performed; otherwise, a logical shift is performed. Shifts by 31 bits, which are commonly used to check
+	; for negative numbers, are special-cased.
+.proc alusrlsra
+	tax
+	lda vin+3
+	and #$0040
+	bne sra
+
+	lda vs2
+	and #$001f
+	cmp #$001f
+	beq srl31
+	jmp shift::srl
+srl31:
+	lda vx0+64,y
+	asl          ; Put the high bit of the source register into C.
+	lda #0
+	rol
+	sta vx0,x
+	stz vx0+64,x
+	next
+
+sra:
+	lda vs2
+	and #$001f
+	cmp #$001f
+	beq sra31
+	jmp shift::sra
+sra31:
+	lda vx0+64,y
+	asl          ; Put the high bit of the source register into C, then fill the destination with it.
+	lda #0
+	bcc :+
+	dec a
+:	sta vx0,x
+	sta vx0+64,x
+	next
+.endproc
+
+	; aluor implements the or and ori instructions.
+.proc aluor
+	tax
+	aluop ora
+	next
+.endproc
+
+	; aluand implements the and and andi instructions.
+.proc aluand
+	tax
+	aluop and
+	next
+.endproc
+
+	; run is the main loop of the simulator. It fetches the next instruction and dispatches execution to its handler.
+.proc run
+	fetch
+.endproc
+
+	; addpc4 increments the virtual program counter by 4 bytes. The carry out of the low word is rare.
+.proc addpc4
+	clc
+	lda vpc
+	adc #4
+	sta vpc
+	bcc run
+	inc vpc+2
+	jmp run
+.endproc
+
+	; opinv is the implementation of an invalid opcode. An invalid opcode will halt the simulator.
+.proc opinv
+	rts
+.endproc
+
+	; oplx implements the LOAD group. The effective address is computed into vs1 and funct3 selects the load kernel.
+	; Loads that target x0 still perform the read, byte by byte, using a table that maps funct3 to the load width.
+.proc oplx
+	ldars1
+	tax
+	ldimmi
+	addea
+	ldf3
+	tax
+	ldard
+	beq nw
+	jmp (jlxtable,x)
+
+nw:
+	lda jnwtable,x
+	and #$00ff
+	tax
+	ldy #0
+	sep #$20
+	.a8
+rl:	lda [vs1],y
+	iny
+	dex
+	bne rl
+	rep #$20
+	.a16
+	next
+
+lxw:
+	tax
+	lda [vs1]
+	sta vx0,x
+	ldy #2
+	lda [vs1],y
+	sta vx0+64,x
+	next
+
+lxh:
+	tax
+	ldy #0
+	lda [vs1]
+	sta vx0,x
+	bpl :+
+	dey
+:	sty vx0+64,x
+	next
+
+lxb:
+	tax
+	ldy #0
+	sep #$20     ; Read exactly one byte: the next one may be an I/O register.
+	.a8
+	lda [vs1]
+	rep #$20
+	.a16
+	and #$00ff
+	eor #$0080   ; Sign-extend the byte to 16 bits.
+	sec
+	sbc #$0080
+	sta vx0,x
+	bpl :+
+	dey
+:	sty vx0+64,x
+	next
+
+lxhu:
+	tax
+	lda [vs1]
+	sta vx0,x
+	stz vx0+64,x
+	next
+
+lxbu:
+	tax
+	sep #$20
+	.a8
+	lda [vs1]
+	rep #$20
+	.a16
+	and #$00ff
+	sta vx0,x
+	stz vx0+64,x
+	next
+
+jnwtable:
+	.byte 1, 0, 2, 0, 4, 0, 4, 0, 1, 0, 2, 0
+
+jlxtable:
+	.word lxb, lxh, lxw, lxw, lxbu, lxhu
+.endproc
+
+	; opfence implements the MISC-MEM group.
+.proc opfence
+	next
+.endproc
+
+	; opimm implements the OP-IMM group.
+.proc opimm
+	ldy #0
+	ldimmi
+	sta vs2
+	bpl :+
+	dey
+:	sty vs2+2
+.endproc
+
+	; alu is the common code shared by instructions in the OP-IMM and OP groups.
+.proc alu
+	ldars1
+	tay
+	ldf3
+	tax
+
+	; If rd refers to x0, do nothing: an ALU operator is side-effect-free aside from writing the destination register.
+	ldard
+	beq skip
+	jmp (alutab,x)
+
+skip:
+	next
+.endproc
+
+	; opauipc implements the auipc instruction.
+.proc opauipc
+	ldard
+	beq skip
+	tax
+	lda vin
+	and #$f000
+	clc
+	adc vpc
+	sta vx0,x
+	lda vin+2
+	adc vpc+2
+	sta vx0+64,x
+skip:
+	next
+.endproc
+
+	; opsx implements the STORE group. The S-type immediate is split between the rd field, which supplies its low five
+	; bits, and the funct7 field, which occupies the upper seven bits of the word at vin+2.
+.proc opsx
+	ldars1
+	tax
+	lda vin
+	asl
+	xba
+	and #$001f
+	sta vs1
+	lda vin+2
+	asr4
+	and #$ffe0
+	ora vs1
+	addea
+	ldf3
+	tax
+	ldars2
+	jmp (jsxtable,x)
+
+sxw:
+	tax
+	lda vx0,x
+	sta [vs1]
+	ldy #2
+	lda vx0+64,x
+	sta [vs1],y
+	next
+
+sxh:
+	tax
+	lda vx0,x
+	sta [vs1]
+	next
+
+sxb:
+	tax
+	sep #$20
+	.a8
+	lda vx0,x
+	sta [vs1]
+	rep #$20
+	.a16
+	next
+
+jsxtable:
+	.word sxb, sxh, sxw
+.endproc
+
+	; opop implements the OP group.
+.proc opop
+	ldars2
+	tax
+	lda vx0,x
+	sta vs2
+	lda vx0+64,x
+	sta vs2+2
+	jmp alu
+.endproc
+
+	; oplui implements the lui instruction.
+.proc oplui
+	ldard
+	beq skip
+	tax
+	lda vin
+	and #$f000
+	sta vx0,x
+	lda vin+2
+	sta vx0+64,x
+skip:
+	next
+.endproc
+
+	; bxregs loads the offsets of the registers to compare for a branch into Y (rs1) and X (rs2).
+.macro bxregs
+	ldars1
+	tay
+	ldars2
+	tax
+.endmacro
+
+	; bxsub subtracts the branch's second operand from its first, leaving the flags from the high half in P.
+.macro bxsub
+	sec
+	lda vx0,y
+	sbc vx0,x
+	lda vx0+64,y
+	sbc vx0+64,x
+.endmacro
+
+	; opbxx implements the BRANCH group. funct3 selects a handler for each branch condition.
+.proc opbxx
+	ldf3
+	tax
+	jmp (jbxtable,x)
+
+bxeq:
+	bxregs
+	lda vx0,y
+	cmp vx0,x
+	bne :+
+	lda vx0+64,y
+	cmp vx0+64,x
+	bne :+
+	jmp bxtaken
+:	next
+
+bxne:
+	bxregs
+	lda vx0,y
+	cmp vx0,x
+	bne :+
+	lda vx0+64,y
+	cmp vx0+64,x
+	bne :+
+	next
+:	jmp bxtaken
+
+bxlt:
+	bxregs
+	bxsub
+	bvc :+
+	eor #$8000   ; The first operand is less than the second if N != V.
+:	bpl :+
+	jmp bxtaken
+:	next
+
+bxge:
+	bxregs
+	bxsub
+	bvc :+
+	eor #$8000
+:	bmi :+
+	jmp bxtaken
+:	next
+
+bxltu:
+	bxregs
+	bxsub
+	bcs :+
+	jmp bxtaken
+:	next
+
+bxgeu:
+	bxregs
+	bxsub
+	bcc :+
+	jmp bxtaken
+:	next
+
+jbxtable:
+	.word bxeq, bxne, opinv, opinv, bxlt, bxge, bxltu, bxgeu
+.endproc
+
+	; bxtaken adds the sign-extended 13-bit B-type immediate of the executing instruction to the VPC and executes the
+	; instruction at the branch target. imm[4:1] are bits 8-11 and imm[11] is bit 7 of the instruction; imm[10:5] and
+	; the sign occupy the upper seven bits of the word at vin+2.
+.proc bxtaken
+	lda vin
+	xba
+	asl          ; C = imm[11], bits 1-4 = imm[4:1]
+	and #$001e
+	sta vs2
+	bcc :+
+	lda #$0800
+	tsb vs2
+:	lda vin+2
+	asr4
+	and #$f7e0
+	ora vs2      ; N = the sign of the offset
+	bmi back
+	clc
+	adc vpc
+	sta vpc
+	bcc :+
+	inc vpc+2
+:	dispatch
+back:
+	clc
+	adc vpc
+	sta vpc
+	bcs :+
+	dec vpc+2
+:	dispatch
+.endproc
+
+	; opjalr implements the jalr instruction. The target is computed before rd is written, as rd may be the same
+	; register as rs1.
+.proc opjalr
+	ldars1
+	tax
+	ldimmi
+	addea
+	link
+	lda vs1
+	and #$fffe
+	sta vpc
+	lda vs1+2
+	sta vpc+2
+	dispatch
+.endproc
+
+	; opjal implements the jal instruction. imm[19:12] are already in place in bits 12-19 of the instruction. The word at
+	; vin+2 holds imm[11] in bit 4, imm[10:1] in bits 5-14, and the sign in bit 15.
+.proc opjal
+	link
+	lda vin+2
+	lsr
+	lsr
+	lsr
+	lsr
+	tay          ; Y bit 0 = imm[11]
+	and #$07fe
+	sta vs2
+	tya
+	lsr          ; C = imm[11]
+	lda vin
+	and #$f000
+	ora vs2
+	bcc :+
+	ora #$0800
+:	sta vs2
+	lda vin+2
+	and #$000f
+	bit vin+2
+	bpl :+
+	ora #$fff0
+:	sta vs2+2
+	clc
+	lda vpc
+	adc vs2
+	sta vpc
+	lda vpc+2
+	adc vs2+2
+	sta vpc+2
+	dispatch
+.endproc
+
+	; opsystem implements ecall. As in riscv.s, a0 holds the address of a 6502 routine to call and a1 holds the values
+	; of A, X, Y, and P to call it with; the routine's A, X, Y, and P are returned in a0. The routine is called in
+	; emulation mode so that 6502 code, including the firmware, runs unmodified.
+.proc opsystem
+	lda vx0+20   ; a0
+	sta tg
+	sep #$30
+	.a8
+	.i8
+	lda vx0+64+23 ; a1 byte 3
+	pha
+	lda vx0+22    ; a1 byte 0
+	ldx vx0+23    ; a1 byte 1
+	ldy vx0+64+22 ; a1 byte 2
+	sec
+	xce
+	plp
+	.byte $20
+tg:	.byte $00,$00
+	php
+	clc
+	xce
+	sta vx0+20
+	stx vx0+21
+	sty vx0+64+20
+	pla
+	sta vx0+64+21
+	rep #$30
+	.a16
+	.i16
+	next
+.endproc
+
+.segment "DATA"
+	.align 256
+optab:
+	.word oplx
+	.word 0
+	.word opinv
+	.word 0
+	.word opinv
+	.word 0
+	.word opfence
+	.word 0
+	.word opimm
+	.word 0
+	.word opauipc
+	.word 0
+	.word opinv
+	.word 0
+	.word opinv
+	.word 0
+	.word opsx
+	.word 0
+	.word opinv
+	.word 0
+	.word opinv
+	.word 0
+	.word opinv
+	.word 0
+	.word opop
+	.word 0
+	.word oplui
+	.word 0
+	.word opinv
+	.word 0
+	.word opinv
+	.word 0
+	.word opinv
+	.word 0
+	.word opinv
+	.word 0
+	.word opinv
+	.word 0
+	.word opinv
+	.word 0
+	.word opinv
+	.word 0
+	.word opinv
+	.word 0
+	.word opinv
+	.word 0
+	.word opinv
+	.word 0
+	.word opbxx
+	.word 0
+	.word opjalr
+	.word 0
+	.word opinv
+	.word 0
+	.word opjal
+	.word 0
+	.word opsystem
+	.word 0
+	.word opinv
+	.word 0
+	.word opinv
+	.word 0
+	.word opinv
+	.word 0
+alutab:
+	.word aluaddsub
+	.word alusll
+	.word aluslt
+	.word alusltu
+	.word aluxor
+	.word alusrlsra
+	.word aluor
+	.word aluand
@@ -28,5 +28,16 @@
 reset:
 	.import start
 	.word start
+irq:
+	.import kbirq
+	.word kbirq
 
-.export clreol, couta, rdkeya, reset
+	; The 65C816 interpreter takes interrupts in native mode, which vectors through $ffee.
+.if .defined(native)
+.segment "NIRQ"
+	.org $ffee
+	.import nirq
+	.word nirq
+.endif
+
+.export clreol, couta, rdkeya, reset, irq
@@ -102,11 +102,17 @@
  *                                                   *
  *****************************************************/
 
+#ifdef __APPLE__
 #include <mach/mach_time.h>
+#endif
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/fcntl.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
 
@@ -173,7 +179,7 @@
 //6502 CPU registers
 uint16_t pc;
 uint8_t sp, a, x, y, status;
-uint8_t kill;
+uint8_t halted;
 
 
 //helper variables
@@ -183,8 +189,8 @@ uint16_t oldpc, ea, reladdr, value, result;
 uint8_t opcode, oldstatus;
 
 //externally supplied functions
-extern uint8_t read6502(uint16_t address);
-extern void write6502(uint16_t address, uint8_t value);
+extern uint8_t read6502(uint32_t address);
+extern void write6502(uint32_t address, uint8_t value);
 
 //a few general functions used by various other functions
 void push16(uint16_t pushval) {
@@ -1002,7 +1008,921 @@ void hookexternal(void *funcptr) {
     } else callexternal = 0;
 }
 
-static uint8_t memory[65536];
+//65C816 core
+//
+//When the simulator is started with -816, instructions are executed by the core below rather than the 6502 core
+//above. It shares pc, status, the cycle and instruction counters and the memory interface with the 6502 core, and
+//adds the 65C816's emulation flag, its 16-bit accumulator, index, stack and direct page registers, and its data and
+//program bank registers. Addresses are 24 bits wide. In emulation mode it behaves as a 65C02.
+//
+//Cycle counts follow the W65C816S datasheet: the ticktable816 entries are for 8-bit registers, and an extra cycle is
+//added for each additional byte of a 16-bit operand, for direct page accesses when the low byte of D is not zero, and
+//for indexed reads that cross a page or use 16-bit index registers.
+
+#define FLAG_INDEX     0x10 //native mode only: the index registers are 8 bits wide
+#define FLAG_MEMORY    0x20 //native mode only: the accumulator and memory operands are 8 bits wide
+
+#define M16 (!e816 && (status & FLAG_MEMORY) == 0)
+#define X16 (!e816 && (status & FLAG_INDEX) == 0)
+
+//65C816 CPU registers
+uint8_t cpu816 = 0; //nonzero if instructions are executed by the 65C816 core
+uint8_t e816 = 1, dbr816, pbr816;
+uint16_t c816, x816, y816, s816 = 0x01FD, d816;
+
+static uint32_t ea816;
+static uint8_t wrap816; //ea816 is a direct page or stack address, so 16-bit accesses wrap within bank 0
+
+static void (*addrtable816[256])();
+
+static uint8_t rd816(uint32_t address) {
+    return read6502(address & 0xFFFFFF);
+}
+
+static void wr816(uint32_t address, uint8_t value) {
+    write6502(address & 0xFFFFFF, value);
+}
+
+static uint32_t next816(uint32_t address) { //the address of the second byte of a 16-bit operand at address
+    return wrap816 ? ((address + 1) & 0xFFFF) : ((address + 1) & 0xFFFFFF);
+}
+
+static uint8_t fetch816() {
+    uint8_t v = rd816(((uint32_t)pbr816 << 16) | pc);
+    pc++;
+    return v;
+}
+
+static uint16_t fetch16_816() {
+    uint16_t lo = fetch816();
+    return lo | ((uint16_t)fetch816() << 8);
+}
+
+static void push816(uint8_t pushval) {
+    wr816(s816, pushval);
+    s816 = e816 ? (0x100 | ((s816 - 1) & 0xFF)) : (uint16_t)(s816 - 1);
+}
+
+static void push16_816(uint16_t pushval) {
+    push816((pushval >> 8) & 0xFF);
+    push816(pushval & 0xFF);
+}
+
+static uint8_t pull816() {
+    s816 = e816 ? (0x100 | ((s816 + 1) & 0xFF)) : (uint16_t)(s816 + 1);
+    return rd816(s816);
+}
+
+static uint16_t pull16_816() {
+    uint16_t lo = pull816();
+    return lo | ((uint16_t)pull816() << 8);
+}
+
+static uint32_t dp816(uint16_t offset) { //the bank 0 address of a direct page offset
+    if ((d816 & 0xFF) != 0) return (d816 + offset) & 0xFFFF;
+    if (e816) return d816 | (offset & 0xFF); //direct page wraparound in emulation mode
+    return (d816 + offset) & 0xFFFF;
+}
+
+static uint16_t dpword816(uint16_t offset) {
+    return (uint16_t)rd816(dp816(offset)) | ((uint16_t)rd816(dp816(offset + 1)) << 8);
+}
+
+static uint32_t dplong816(uint16_t offset) {
+    return (uint32_t)dpword816(offset) | ((uint32_t)rd816(dp816(offset + 2)) << 16);
+}
+
+static uint8_t dpoffset816() { //fetches a direct page offset, charging a cycle if D is not page-aligned
+    if ((d816 & 0xFF) != 0) clockticks6502++;
+    return fetch816();
+}
+
+static void indexed816(uint32_t base, uint16_t index) {
+    ea816 = (base + index) & 0xFFFFFF;
+    wrap816 = 0;
+    if (X16 || (base & 0xFFFF00) != (ea816 & 0xFFFF00)) penaltyaddr = 1;
+}
+
+//addressing mode functions, calculate effective addresses
+static void imp816() { //implied
+}
+
+static void acc816() { //accumulator
+}
+
+static void immm816() { //immediate, sized by M
+    ea816 = ((uint32_t)pbr816 << 16) | pc;
+    wrap816 = 0;
+    pc += M16 ? 2 : 1;
+}
+
+static void immx816() { //immediate, sized by X
+    ea816 = ((uint32_t)pbr816 << 16) | pc;
+    wrap816 = 0;
+    pc += X16 ? 2 : 1;
+}
+
+static void imm8_816() { //8-bit immediate
+    ea816 = ((uint32_t)pbr816 << 16) | pc++;
+    wrap816 = 0;
+}
+
+static void imm16_816() { //16-bit immediate
+    ea816 = ((uint32_t)pbr816 << 16) | pc;
+    wrap816 = 0;
+    pc += 2;
+}
+
+static void dp_816() { //direct page
+    ea816 = dp816(dpoffset816());
+    wrap816 = 1;
+}
+
+static void dpx816() { //direct page,X
+    ea816 = dp816(dpoffset816() + x816);
+    wrap816 = 1;
+}
+
+static void dpy816() { //direct page,Y
+    ea816 = dp816(dpoffset816() + y816);
+    wrap816 = 1;
+}
+
+static void dpi816() { //(direct page)
+    ea816 = ((uint32_t)dbr816 << 16) | dpword816(dpoffset816());
+    wrap816 = 0;
+}
+
+static void dpix816() { //(direct page,X)
+    ea816 = ((uint32_t)dbr816 << 16) | dpword816(dpoffset816() + x816);
+    wrap816 = 0;
+}
+
+static void dpiy816() { //(direct page),Y
+    indexed816(((uint32_t)dbr816 << 16) | dpword816(dpoffset816()), y816);
+}
+
+static void dpil816() { //[direct page]
+    ea816 = dplong816(dpoffset816());
+    wrap816 = 0;
+}
+
+static void dpily816() { //[direct page],Y
+    ea816 = (dplong816(dpoffset816()) + y816) & 0xFFFFFF;
+    wrap816 = 0;
+}
+
+static void abs816() { //absolute, in the data bank
+    ea816 = ((uint32_t)dbr816 << 16) | fetch16_816();
+    wrap816 = 0;
+}
+
+static void absx816() { //absolute,X
+    indexed816(((uint32_t)dbr816 << 16) | fetch16_816(), x816);
+}
+
+static void absy816() { //absolute,Y
+    indexed816(((uint32_t)dbr816 << 16) | fetch16_816(), y816);
+}
+
+static void absl816() { //absolute long
+    uint16_t lo = fetch16_816();
+    ea816 = ((uint32_t)fetch816() << 16) | lo;
+    wrap816 = 0;
+}
+
+static void abslx816() { //absolute long,X
+    absl816();
+    ea816 = (ea816 + x816) & 0xFFFFFF;
+}
+
+static void absp816() { //absolute, in the program bank (JMP, JSR)
+    ea816 = ((uint32_t)pbr816 << 16) | fetch16_816();
+}
+
+static void ind816() { //(absolute), pointer in bank 0 (JMP)
+    uint16_t eahelp = fetch16_816();
+    ea816 = ((uint32_t)pbr816 << 16) | rd816(eahelp) | ((uint16_t)rd816((uint16_t)(eahelp + 1)) << 8);
+}
+
+static void indx816() { //(absolute,X), pointer in the program bank (JMP, JSR)
+    uint16_t eahelp = fetch16_816() + x816;
+    uint32_t bank = (uint32_t)pbr816 << 16;
+    ea816 = bank | rd816(bank | eahelp) | ((uint16_t)rd816(bank | (uint16_t)(eahelp + 1)) << 8);
+}
+
+static void indl816() { //[absolute], pointer in bank 0 (JML)
+    uint16_t eahelp = fetch16_816();
+    ea816 = rd816(eahelp) | ((uint32_t)rd816((uint16_t)(eahelp + 1)) << 8) |
+        ((uint32_t)rd816((uint16_t)(eahelp + 2)) << 16);
+}
+
+static void sr816() { //stack relative
+    ea816 = (s816 + fetch816()) & 0xFFFF;
+    wrap816 = 1;
+}
+
+static void sriy816() { //(stack relative),Y
+    uint16_t eahelp = s816 + fetch816();
+    uint16_t ptr = rd816(eahelp) | ((uint16_t)rd816((uint16_t)(eahelp + 1)) << 8);
+    ea816 = ((((uint32_t)dbr816 << 16) | ptr) + y816) & 0xFFFFFF;
+    wrap816 = 0;
+}
+
+static void rel816() { //relative for branch ops (8-bit immediate value, sign-extended)
+    reladdr = fetch816();
+    if (reladdr & 0x80) reladdr |= 0xFF00;
+}
+
+static void rell816() { //relative long (BRL, PER)
+    reladdr = fetch16_816();
+}
+
+static uint16_t getvalue816(int wide) {
+    if (addrtable816[opcode] == acc816) return wide ? c816 : (c816 & 0x00FF);
+    if (!wide) return rd816(ea816);
+    clockticks6502++;
+    return (uint16_t)rd816(ea816) | ((uint16_t)rd816(next816(ea816)) << 8);
+}
+
+static void putvalue816(uint16_t saveval, int wide) {
+    if (addrtable816[opcode] == acc816) {
+        c816 = wide ? saveval : ((c816 & 0xFF00) | (saveval & 0x00FF));
+        return;
+    }
+    wr816(ea816, saveval & 0x00FF);
+    if (wide) {
+        clockticks6502++;
+        wr816(next816(ea816), saveval >> 8);
+    }
+}
+
+static void nz816(uint16_t n, int wide) {
+    if (!wide) n &= 0x00FF;
+    if (n == 0) setzero();
+        else clearzero();
+    if (n & (wide ? 0x8000 : 0x0080)) setsign();
+        else clearsign();
+}
+
+static void seta816(uint16_t n) {
+    c816 = M16 ? n : ((c816 & 0xFF00) | (n & 0x00FF));
+    nz816(n, M16);
+}
+
+static void setx816(uint16_t n) {
+    x816 = X16 ? n : (n & 0x00FF);
+    nz816(n, X16);
+}
+
+static void sety816(uint16_t n) {
+    y816 = X16 ? n : (n & 0x00FF);
+    nz816(n, X16);
+}
+
+static void setstatus816(uint8_t n) { //loads P, applying the side effects of the M and X flags
+    if (e816) n |= FLAG_CONSTANT | FLAG_BREAK;
+    status = n;
+    if (!X16) {
+        x816 &= 0x00FF;
+        y816 &= 0x00FF;
+    }
+}
+
+static void branch816(int taken) {
+    if (taken) {
+        oldpc = pc;
+        pc += reladdr;
+        if (e816 && (oldpc & 0xFF00) != (pc & 0xFF00)) clockticks6502 += 2; //page crossing only costs in emulation mode
+            else clockticks6502++;
+    }
+}
+
+static void interrupt816(uint16_t native, uint16_t emulation, uint8_t pushed) {
+    if (!e816) {
+        push816(pbr816);
+        clockticks6502++;
+    }
+    push16_816(pc);
+    push816(pushed);
+    setinterrupt();
+    cleardecimal();
+    pbr816 = 0;
+    uint16_t vector = e816 ? emulation : native;
+    pc = (uint16_t)rd816(vector) | ((uint16_t)rd816(vector + 1) << 8);
+}
+
+//decimal816 adds or subtracts (when sub is set) the BCD values n and m of the given number of digits. The carry out
+//(or the inverted borrow out) is returned in the bit above the result.
+static uint32_t decimal816(uint32_t n, uint32_t m, int carry, int digits, int sub) {
+    uint32_t r = 0;
+    for (int i = 0; i < digits * 4; i += 4) {
+        int d = sub ? ((n >> i) & 0xF) - ((m >> i) & 0xF) - !carry : ((n >> i) & 0xF) + ((m >> i) & 0xF) + carry;
+        if (sub) {
+            carry = d >= 0;
+            if (!carry) d += 10;
+        } else {
+            carry = d > 9;
+            if (carry) d -= 10;
+        }
+        r |= (uint32_t)(d & 0xF) << i;
+    }
+    return r | ((uint32_t)carry << (digits * 4));
+}
+
+//instruction handler functions
+static void adc816() {
+    int wide = M16;
+    uint32_t top = wide ? 0x8000 : 0x80, mask = wide ? 0xFFFF : 0xFF;
+    uint32_t n = c816 & mask, m, r;
+    penaltyop = 1;
+    m = getvalue816(wide);
+    r = n + m + (status & FLAG_CARRY);
+    if ((~(n ^ m) & (n ^ r)) & top) setoverflow();
+        else clearoverflow();
+    if (status & FLAG_DECIMAL) r = decimal816(n, m, status & FLAG_CARRY, wide ? 4 : 2, 0);
+    if (r > mask) setcarry();
+        else clearcarry();
+    seta816(r);
+}
+
+static void and816() {
+    penaltyop = 1;
+    seta816(c816 & getvalue816(M16));
+}
+
+static void asl816() {
+    int wide = M16;
+    uint32_t r = (uint32_t)getvalue816(wide) << 1;
+    if (r & (wide ? 0x10000 : 0x100)) setcarry();
+        else clearcarry();
+    nz816(r, wide);
+    putvalue816(r, wide);
+}
+
+static void bcc816() {
+    branch816((status & FLAG_CARRY) == 0);
+}
+
+static void bcs816() {
+    branch816((status & FLAG_CARRY) != 0);
+}
+
+static void beq816() {
+    branch816((status & FLAG_ZERO) != 0);
+}
+
+static void bit816() {
+    int wide = M16;
+    uint16_t m = getvalue816(wide);
+    penaltyop = 1;
+    if (((c816 & m) & (wide ? 0xFFFF : 0xFF)) == 0) setzero();
+        else clearzero();
+    if (addrtable816[opcode] != immm816) { //BIT # only affects Z
+        uint16_t top = wide ? (m >> 8) : m;
+        status = (status & 0x3F) | (uint8_t)(top & 0xC0);
+    }
+}
+
+static void bmi816() {
+    branch816((status & FLAG_SIGN) != 0);
+}
+
+static void bne816() {
+    branch816((status & FLAG_ZERO) == 0);
+}
+
+static void bpl816() {
+    branch816((status & FLAG_SIGN) == 0);
+}
+
+static void bra816() {
+    branch816(1);
+}
+
+static void brk816() {
+    interrupt816(0xFFE6, 0xFFFE, e816 ? (status | FLAG_BREAK) : status);
+}
+
+static void brl816() {
+    pc += reladdr;
+}
+
+static void bvc816() {
+    branch816((status & FLAG_OVERFLOW) == 0);
+}
+
+static void bvs816() {
+    branch816((status & FLAG_OVERFLOW) != 0);
+}
+
+static void clc816() {
+    clearcarry();
+}
+
+static void cld816() {
+    cleardecimal();
+}
+
+static void cli816() {
+    clearinterrupt();
+}
+
+static void clv816() {
+    clearoverflow();
+}
+
+static void compare816(uint16_t reg, int wide) {
+    uint16_t m = getvalue816(wide);
+    if (!wide) reg &= 0x00FF;
+    if (reg >= m) setcarry();
+        else clearcarry();
+    nz816(reg - m, wide);
+}
+
+static void cmp816() {
+    penaltyop = 1;
+    compare816(c816, M16);
+}
+
+static void cop816() {
+    interrupt816(0xFFE4, 0xFFF4, status);
+}
+
+static void cpx816() {
+    compare816(x816, X16);
+}
+
+static void cpy816() {
+    compare816(y816, X16);
+}
+
+static void dec816() {
+    int wide = M16;
+    uint16_t r = getvalue816(wide) - 1;
+    nz816(r, wide);
+    putvalue816(r, wide);
+}
+
+static void dex816() {
+    setx816(x816 - 1);
+}
+
+static void dey816() {
+    sety816(y816 - 1);
+}
+
+static void eor816() {
+    penaltyop = 1;
+    seta816(c816 ^ getvalue816(M16));
+}
+
+static void inc816() {
+    int wide = M16;
+    uint16_t r = getvalue816(wide) + 1;
+    nz816(r, wide);
+    putvalue816(r, wide);
+}
+
+static void inx816() {
+    setx816(x816 + 1);
+}
+
+static void iny816() {
+    sety816(y816 + 1);
+}
+
+static void jml816() {
+    pbr816 = ea816 >> 16;
+    pc = ea816 & 0xFFFF;
+}
+
+static void jmp816() {
+    pc = ea816 & 0xFFFF;
+}
+
+static void jsl816() {
+    push816(pbr816);
+    push16_816(pc - 1);
+    jml816();
+}
+
+static void jsr816() {
+    push16_816(pc - 1);
+    pc = ea816 & 0xFFFF;
+}
+
+static void lda816() {
+    penaltyop = 1;
+    seta816(getvalue816(M16));
+}
+
+static void ldx816() {
+    penaltyop = 1;
+    setx816(getvalue816(X16));
+}
+
+static void ldy816() {
+    penaltyop = 1;
+    sety816(getvalue816(X16));
+}
+
+static void lsr816() {
+    int wide = M16;
+    uint16_t m = getvalue816(wide), r = m >> 1;
+    if (m & 1) setcarry();
+        else clearcarry();
+    nz816(r, wide);
+    putvalue816(r, wide);
+}
+
+//mvn816 and mvp816 move one byte per execution and re-execute themselves until the count in C underflows.
+static void move816(int step) {
+    uint8_t dst = fetch816(), src = fetch816();
+    dbr816 = dst;
+    wr816(((uint32_t)dst << 16) | y816, rd816(((uint32_t)src << 16) | x816));
+    x816 += step;
+    y816 += step;
+    if (!X16) {
+        x816 &= 0x00FF;
+        y816 &= 0x00FF;
+    }
+    if (c816-- != 0) pc -= 3;
+}
+
+static void mvn816() {
+    move816(1);
+}
+
+static void mvp816() {
+    move816(-1);
+}
+
+static void nop816() {
+}
+
+static void ora816() {
+    penaltyop = 1;
+    seta816(c816 | getvalue816(M16));
+}
+
+static void pea816() {
+    push16_816(getvalue816(1));
+    clockticks6502--; //getvalue816 charges for a 16-bit operand, which PEA's timing already includes
+}
+
+static void pei816() {
+    push16_816((uint16_t)rd816(ea816) | ((uint16_t)rd816(next816(ea816)) << 8));
+}
+
+static void per816() {
+    push16_816(pc + reladdr);
+}
+
+static void pha816() {
+    if (M16) {
+        push16_816(c816);
+        clockticks6502++;
+    } else push816(c816 & 0x00FF);
+}
+
+static void phb816() {
+    push816(dbr816);
+}
+
+static void phd816() {
+    push16_816(d816);
+}
+
+static void phk816() {
+    push816(pbr816);
+}
+
+static void php816() {
+    push816(e816 ? (status | FLAG_BREAK) : status);
+}
+
+static void phx816() {
+    if (X16) {
+        push16_816(x816);
+        clockticks6502++;
+    } else push816(x816 & 0x00FF);
+}
+
+static void phy816() {
+    if (X16) {
+        push16_816(y816);
+        clockticks6502++;
+    } else push816(y816 & 0x00FF);
+}
+
+static void pla816() {
+    if (M16) {
+        clockticks6502++;
+        seta816(pull16_816());
+    } else seta816(pull816());
+}
+
+static void plb816() {
+    dbr816 = pull816();
+    nz816(dbr816, 0);
+}
+
+static void pld816() {
+    d816 = pull16_816();
+    nz816(d816, 1);
+}
+
+static void plp816() {
+    setstatus816(pull816());
+}
+
+static void plx816() {
+    if (X16) clockticks6502++;
+    setx816(X16 ? pull16_816() : pull816());
+}
+
+static void ply816() {
+    if (X16) clockticks6502++;
+    sety816(X16 ? pull16_816() : pull816());
+}
+
+static void rep816() {
+    setstatus816(status & ~rd816(ea816));
+}
+
+static void rol816() {
+    int wide = M16;
+    uint32_t r = ((uint32_t)getvalue816(wide) << 1) | (status & FLAG_CARRY);
+    if (r & (wide ? 0x10000 : 0x100)) setcarry();
+        else clearcarry();
+    nz816(r, wide);
+    putvalue816(r, wide);
+}
+
+static void ror816() {
+    int wide = M16;
+    uint16_t m = getvalue816(wide);
+    uint16_t r = (m >> 1) | ((status & FLAG_CARRY) ? (wide ? 0x8000 : 0x80) : 0);
+    if (m & 1) setcarry();
+        else clearcarry();
+    nz816(r, wide);
+    putvalue816(r, wide);
+}
+
+static void rti816() {
+    setstatus816(pull816());
+    pc = pull16_816();
+    if (!e816) {
+        pbr816 = pull816();
+        clockticks6502++;
+    }
+}
+
+static void rtl816() {
+    pc = pull16_816() + 1;
+    pbr816 = pull816();
+}
+
+static void rts816() {
+    pc = pull16_816() + 1;
+}
+
+static void sbc816() {
+    int wide = M16;
+    uint32_t top = wide ? 0x8000 : 0x80, mask = wide ? 0xFFFF : 0xFF;
+    uint32_t n = c816 & mask, m, r;
+    penaltyop = 1;
+    m = getvalue816(wide);
+    r = n + (m ^ mask) + (status & FLAG_CARRY);
+    if (((n ^ m) & (n ^ r)) & top) setoverflow();
+        else clearoverflow();
+    if (status & FLAG_DECIMAL) r = decimal816(n, m, status & FLAG_CARRY, wide ? 4 : 2, 1);
+    if (r > mask) setcarry();
+        else clearcarry();
+    seta816(r);
+}
+
+static void sec816() {
+    setcarry();
+}
+
+static void sed816() {
+    setdecimal();
+}
+
+static void sei816() {
+    setinterrupt();
+}
+
+static void sep816() {
+    setstatus816(status | rd816(ea816));
+}
+
+static void sta816() {
+    putvalue816(c816, M16);
+}
+
+static void stp816() {
+    halted = 1;
+}
+
+static void stx816() {
+    putvalue816(x816, X16);
+}
+
+static void sty816() {
+    putvalue816(y816, X16);
+}
+
+static void stz816() {
+    putvalue816(0, M16);
+}
+
+static void tax816() {
+    setx816(c816);
+}
+
+static void tay816() {
+    sety816(c816);
+}
+
+static void tcd816() {
+    d816 = c816;
+    nz816(d816, 1);
+}
+
+static void tcs816() {
+    s816 = e816 ? (0x100 | (c816 & 0xFF)) : c816;
+}
+
+static void tdc816() {
+    c816 = d816;
+    nz816(c816, 1);
+}
+
+static void trb816() {
+    int wide = M16;
+    uint16_t m = getvalue816(wide);
+    if (((c816 & m) & (wide ? 0xFFFF : 0xFF)) == 0) setzero();
+        else clearzero();
+    putvalue816(m & ~c816, wide);
+}
+
+static void tsb816() {
+    int wide = M16;
+    uint16_t m = getvalue816(wide);
+    if (((c816 & m) & (wide ? 0xFFFF : 0xFF)) == 0) setzero();
+        else clearzero();
+    putvalue816(m | c816, wide);
+}
+
+static void tsc816() {
+    c816 = s816;
+    nz816(c816, 1);
+}
+
+static void tsx816() {
+    setx816(s816);
+}
+
+static void txa816() {
+    seta816(x816);
+}
+
+static void txs816() {
+    s816 = e816 ? (0x100 | (x816 & 0xFF)) : x816;
+}
+
+static void txy816() {
+    sety816(x816);
+}
+
+static void tya816() {
+    seta816(y816);
+}
+
+static void tyx816() {
+    setx816(y816);
+}
+
+static void wai816() {
+}
+
+static void xba816() {
+    c816 = (c816 >> 8) | (c816 << 8);
+    nz816(c816, 0);
+}
+
+static void xce816() {
+    uint8_t carry = status & FLAG_CARRY;
+    if (e816) setcarry();
+        else clearcarry();
+    e816 = carry;
+    if (e816) {
+        s816 = 0x100 | (s816 & 0xFF);
+        setstatus816(status);
+    } else status |= FLAG_MEMORY | FLAG_INDEX;
+}
+
+static void (*addrtable816[256])() = {
+/*        |    0    |    1    |    2    |    3    |    4    |    5    |    6    |    7    |    8    |    9    |    A    |    B    |    C    |    D    |    E    |    F    |     */
+/* 0 */   imm8_816,  dpix816, imm8_816,    sr816,   dp_816,   dp_816,   dp_816,  dpil816,   imp816,  immm816,   acc816,   imp816,   abs816,   abs816,   abs816,  absl816, /* 0 */
+/* 1 */     rel816,  dpiy816,   dpi816,  sriy816,   dp_816,   dpx816,   dpx816, dpily816,   imp816,  absy816,   acc816,   imp816,   abs816,  absx816,  absx816, abslx816, /* 1 */
+/* 2 */    absp816,  dpix816,  absl816,    sr816,   dp_816,   dp_816,   dp_816,  dpil816,   imp816,  immm816,   acc816,   imp816,   abs816,   abs816,   abs816,  absl816, /* 2 */
+/* 3 */     rel816,  dpiy816,   dpi816,  sriy816,   dpx816,   dpx816,   dpx816, dpily816,   imp816,  absy816,   acc816,   imp816,  absx816,  absx816,  absx816, abslx816, /* 3 */
+/* 4 */     imp816,  dpix816, imm8_816,    sr816,   imp816,   dp_816,   dp_816,  dpil816,   imp816,  immm816,   acc816,   imp816,  absp816,   abs816,   abs816,  absl816, /* 4 */
+/* 5 */     rel816,  dpiy816,   dpi816,  sriy816,   imp816,   dpx816,   dpx816, dpily816,   imp816,  absy816,   imp816,   imp816,  absl816,  absx816,  absx816, abslx816, /* 5 */
+/* 6 */     imp816,  dpix816,  rell816,    sr816,   dp_816,   dp_816,   dp_816,  dpil816,   imp816,  immm816,   acc816,   imp816,   ind816,   abs816,   abs816,  absl816, /* 6 */
+/* 7 */     rel816,  dpiy816,   dpi816,  sriy816,   dpx816,   dpx816,   dpx816, dpily816,   imp816,  absy816,   imp816,   imp816,  indx816,  absx816,  absx816, abslx816, /* 7 */
+/* 8 */     rel816,  dpix816,  rell816,    sr816,   dp_816,   dp_816,   dp_816,  dpil816,   imp816,  immm816,   imp816,   imp816,   abs816,   abs816,   abs816,  absl816, /* 8 */
+/* 9 */     rel816,  dpiy816,   dpi816,  sriy816,   dpx816,   dpx816,   dpy816, dpily816,   imp816,  absy816,   imp816,   imp816,   abs816,  absx816,  absx816, abslx816, /* 9 */
+/* A */    immx816,  dpix816,  immx816,    sr816,   dp_816,   dp_816,   dp_816,  dpil816,   imp816,  immm816,   imp816,   imp816,   abs816,   abs816,   abs816,  absl816, /* A */
+/* B */     rel816,  dpiy816,   dpi816,  sriy816,   dpx816,   dpx816,   dpy816, dpily816,   imp816,  absy816,   imp816,   imp816,  absx816,  absx816,  absy816, abslx816, /* B */
+/* C */    immx816,  dpix816, imm8_816,    sr816,   dp_816,   dp_816,   dp_816,  dpil816,   imp816,  immm816,   imp816,   imp816,   abs816,   abs816,   abs816,  absl816, /* C */
+/* D */     rel816,  dpiy816,   dpi816,  sriy816,   dp_816,   dpx816,   dpx816, dpily816,   imp816,  absy816,   imp816,   imp816,  indl816,  absx816,  absx816, abslx816, /* D */
+/* E */    immx816,  dpix816, imm8_816,    sr816,   dp_816,   dp_816,   dp_816,  dpil816,   imp816,  immm816,   imp816,   imp816,   abs816,   abs816,   abs816,  absl816, /* E */
+/* F */     rel816,  dpiy816,   dpi816,  sriy816, imm16_816,  dpx816,   dpx816, dpily816,   imp816,  absy816,   imp816,   imp816,  indx816,  absx816,  absx816, abslx816  /* F */
+};
+
+static void (*optable816[256])() = {
+/*        |    0    |    1    |    2    |    3    |    4    |    5    |    6    |    7    |    8    |    9    |    A    |    B    |    C    |    D    |    E    |    F    |     */
+/* 0 */     brk816,   ora816,   cop816,   ora816,   tsb816,   ora816,   asl816,   ora816,   php816,   ora816,   asl816,   phd816,   tsb816,   ora816,   asl816,   ora816, /* 0 */
+/* 1 */     bpl816,   ora816,   ora816,   ora816,   trb816,   ora816,   asl816,   ora816,   clc816,   ora816,   inc816,   tcs816,   trb816,   ora816,   asl816,   ora816, /* 1 */
+/* 2 */     jsr816,   and816,   jsl816,   and816,   bit816,   and816,   rol816,   and816,   plp816,   and816,   rol816,   pld816,   bit816,   and816,   rol816,   and816, /* 2 */
+/* 3 */     bmi816,   and816,   and816,   and816,   bit816,   and816,   rol816,   and816,   sec816,   and816,   dec816,   tsc816,   bit816,   and816,   rol816,   and816, /* 3 */
+/* 4 */     rti816,   eor816,   nop816,   eor816,   mvp816,   eor816,   lsr816,   eor816,   pha816,   eor816,   lsr816,   phk816,   jmp816,   eor816,   lsr816,   eor816, /* 4 */
+/* 5 */     bvc816,   eor816,   eor816,   eor816,   mvn816,   eor816,   lsr816,   eor816,   cli816,   eor816,   phy816,   tcd816,   jml816,   eor816,   lsr816,   eor816, /* 5 */
+/* 6 */     rts816,   adc816,   per816,   adc816,   stz816,   adc816,   ror816,   adc816,   pla816,   adc816,   ror816,   rtl816,   jmp816,   adc816,   ror816,   adc816, /* 6 */
+/* 7 */     bvs816,   adc816,   adc816,   adc816,   stz816,   adc816,   ror816,   adc816,   sei816,   adc816,   ply816,   tdc816,   jmp816,   adc816,   ror816,   adc816, /* 7 */
+/* 8 */     bra816,   sta816,   brl816,   sta816,   sty816,   sta816,   stx816,   sta816,   dey816,   bit816,   txa816,   phb816,   sty816,   sta816,   stx816,   sta816, /* 8 */
+/* 9 */     bcc816,   sta816,   sta816,   sta816,   sty816,   sta816,   stx816,   sta816,   tya816,   sta816,   txs816,   txy816,   stz816,   sta816,   stz816,   sta816, /* 9 */
+/* A */     ldy816,   lda816,   ldx816,   lda816,   ldy816,   lda816,   ldx816,   lda816,   tay816,   lda816,   tax816,   plb816,   ldy816,   lda816,   ldx816,   lda816, /* A */
+/* B */     bcs816,   lda816,   lda816,   lda816,   ldy816,   lda816,   ldx816,   lda816,   clv816,   lda816,   tsx816,   tyx816,   ldy816,   lda816,   ldx816,   lda816, /* B */
+/* C */     cpy816,   cmp816,   rep816,   cmp816,   cpy816,   cmp816,   dec816,   cmp816,   iny816,   cmp816,   dex816,   wai816,   cpy816,   cmp816,   dec816,   cmp816, /* C */
+/* D */     bne816,   cmp816,   cmp816,   cmp816,   pei816,   cmp816,   dec816,   cmp816,   cld816,   cmp816,   phx816,   stp816,   jml816,   cmp816,   dec816,   cmp816, /* D */
+/* E */     cpx816,   sbc816,   sep816,   sbc816,   cpx816,   sbc816,   inc816,   sbc816,   inx816,   sbc816,   nop816,   xba816,   cpx816,   sbc816,   inc816,   sbc816, /* E */
+/* F */     beq816,   sbc816,   sbc816,   sbc816,   pea816,   sbc816,   inc816,   sbc816,   sed816,   sbc816,   plx816,   xce816,   jsr816,   sbc816,   inc816,   sbc816  /* F */
+};
+
+static const uint32_t ticktable816[256] = {
+/*        |  0  |  1  |  2  |  3  |  4  |  5  |  6  |  7  |  8  |  9  |  A  |  B  |  C  |  D  |  E  |  F  |     */
+/* 0 */      7,    6,    7,    4,    5,    3,    5,    6,    3,    2,    2,    4,    6,    4,    6,    5,  /* 0 */
+/* 1 */      2,    5,    5,    7,    5,    4,    6,    6,    2,    4,    2,    2,    6,    4,    7,    5,  /* 1 */
+/* 2 */      6,    6,    8,    4,    3,    3,    5,    6,    4,    2,    2,    5,    4,    4,    6,    5,  /* 2 */
+/* 3 */      2,    5,    5,    7,    4,    4,    6,    6,    2,    4,    2,    2,    4,    4,    7,    5,  /* 3 */
+/* 4 */      6,    6,    2,    4,    7,    3,    5,    6,    3,    2,    2,    3,    3,    4,    6,    5,  /* 4 */
+/* 5 */      2,    5,    5,    7,    7,    4,    6,    6,    2,    4,    3,    2,    4,    4,    7,    5,  /* 5 */
+/* 6 */      6,    6,    6,    4,    3,    3,    5,    6,    4,    2,    2,    6,    5,    4,    6,    5,  /* 6 */
+/* 7 */      2,    5,    5,    7,    4,    4,    6,    6,    2,    4,    4,    2,    6,    4,    7,    5,  /* 7 */
+/* 8 */      2,    6,    4,    4,    3,    3,    3,    6,    2,    2,    2,    3,    4,    4,    4,    5,  /* 8 */
+/* 9 */      2,    6,    5,    7,    4,    4,    4,    6,    2,    5,    2,    2,    4,    5,    5,    5,  /* 9 */
+/* A */      2,    6,    2,    4,    3,    3,    3,    6,    2,    2,    2,    4,    4,    4,    4,    5,  /* A */
+/* B */      2,    5,    5,    7,    4,    4,    4,    6,    2,    4,    2,    2,    4,    4,    4,    5,  /* B */
+/* C */      2,    6,    3,    4,    3,    3,    5,    6,    2,    2,    2,    3,    4,    4,    6,    5,  /* C */
+/* D */      2,    5,    5,    7,    6,    4,    6,    6,    2,    4,    3,    3,    6,    4,    7,    5,  /* D */
+/* E */      2,    6,    3,    4,    3,    3,    5,    6,    2,    2,    2,    3,    4,    4,    6,    5,  /* E */
+/* F */      2,    5,    5,    7,    5,    4,    6,    6,    2,    4,    4,    2,    8,    4,    7,    5   /* F */
+};
+
+void reset65816() {
+    e816 = 1;
+    dbr816 = pbr816 = 0;
+    d816 = 0;
+    s816 = 0x01FD;
+    x816 &= 0x00FF;
+    y816 &= 0x00FF;
+    pc = (uint16_t)rd816(0xFFFC) | ((uint16_t)rd816(0xFFFD) << 8);
+    status |= FLAG_CONSTANT | FLAG_BREAK | FLAG_INTERRUPT;
+}
+
+void irq65816() {
+    interrupt816(0xFFEE, 0xFFFE, e816 ? (status & ~FLAG_BREAK) : status);
+}
+
+void step65816() {
+    opcode = fetch816();
+    if (e816) status |= FLAG_CONSTANT;
+
+    penaltyop = 0;
+    penaltyaddr = 0;
+
+    (*addrtable816[opcode])();
+    (*optable816[opcode])();
+    clockticks6502 += ticktable816[opcode];
+    if (penaltyop && penaltyaddr) clockticks6502++;
+    clockgoal6502 = clockticks6502;
+
+    //Mirror the registers that the harness inspects.
+    a = c816 & 0xFF;
+    sp = s816 & 0xFF;
+
+    instructions++;
+
+    if (callexternal) (*loopexternal)();
+}
+
+static uint8_t memory[1 << 24]; // The 65C816 core can address 16MB. The 6502 core only uses bank 0.
 static uint32_t profile[65536];
 static uint64_t cycles[65536];
 static int riscv_instructions;
@@ -1011,42 +1931,169 @@ enum {
 	STDIO = 0xe000,
 	TRAP = 0xe001,
 	INST = 0xe002,
+
+	BLK_ADDR = 0xe010,
+	BLK_LEN = 0xe012,
+	BLK_CMD = 0xe014,
+
+	ACIA_DATA = 0xc0a8,
+	ACIA_STATUS = 0xc0a9,
+	ACIA_COMMAND = 0xc0aa,
 };
 
-uint8_t read6502(uint16_t address) {
+// The block device copies memory to and from the file named by -disk, so that a program can save and restore its
+// state in one transfer. A program writes a 16-bit address to BLK_ADDR and a length to BLK_LEN, then a command to
+// BLK_CMD. Reading BLK_CMD returns 0 if the last command succeeded. Transfers are sequential from the last open.
+enum {
+	BLK_CREATE = 1, // open the file for writing, truncating it
+	BLK_OPEN = 2,   // open the file for reading
+	BLK_WRITE = 3,
+	BLK_READ = 4,
+};
+
+static const char *disk_path;
+static FILE *disk;
+static uint8_t blk_status;
+
+// The emulated ACIA delivers at most one byte of stdin every ACIA_BYTE_CYCLES cycles, which approximates a 9600bps
+// serial line on a 1MHz machine.
+enum {
+	ACIA_BYTE_CYCLES = 1042,
+
+	ACIA_STATUS_RDRF = 0x08,
+	ACIA_STATUS_IRQ = 0x80,
+};
+
+static uint8_t acia_data;
+static uint8_t acia_status;
+static uint8_t acia_command;
+static uint32_t acia_last;
+static int acia_eof;
+
+// simcommand handles the simulator's in-band commands. It returns 1 if c was a command and should not be passed on to
+// the program.
+static int simcommand(int c) {
+	switch (c) {
+	case '`':
+		printf("6502 cycles: %d\n", clockticks6502);
+		printf("6502 instrs: %d\n", instructions);
+		printf("RISCV instrs: %d\n", riscv_instructions);
+		return 1;
+	case '~':
+		for (int i = 0; i < 65536; i++) {
+			if (profile[i] != 0) {
+				fprintf(stderr, "%04x,%u,%llu\n", i, profile[i], (unsigned long long)cycles[i]);
+			}
+		}
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static void blk_command(uint8_t cmd) {
+	uint32_t addr = memory[BLK_ADDR] | (uint32_t)memory[BLK_ADDR + 1] << 8;
+	uint32_t len = memory[BLK_LEN] | (uint32_t)memory[BLK_LEN + 1] << 8;
+
+	blk_status = 0xff;
+	if (addr + len > 0x10000) {
+		return;
+	}
+	switch (cmd) {
+	case BLK_CREATE:
+	case BLK_OPEN:
+		if (disk != NULL) {
+			fclose(disk);
+		}
+		disk = disk_path == NULL ? NULL : fopen(disk_path, cmd == BLK_CREATE ? "wb" : "rb");
+		if (disk != NULL) {
+			blk_status = 0;
+		}
+		break;
+	case BLK_WRITE:
+		if (disk != NULL && fwrite(&memory[addr], 1, len, disk) == len && fflush(disk) == 0) {
+			blk_status = 0;
+		}
+		break;
+	case BLK_READ:
+		if (disk != NULL && fread(&memory[addr], 1, len, disk) == len) {
+			blk_status = 0;
+		}
+		break;
+	}
+}
+
+// acia_tick moves the next byte of stdin into the ACIA's receive register once the previous byte has been read, and
+// raises an IRQ if the program has enabled receive interrupts (command register bit 1 clear, DTR on).
+static void acia_tick() {
+	// Leave stdin alone until the program turns the ACIA on (DTR) so that it can still be read through STDIO.
+	if ((acia_command & 0x01) != 0 && (acia_status & ACIA_STATUS_RDRF) == 0 && !acia_eof &&
+		clockticks6502 - acia_last >= ACIA_BYTE_CYCLES) {
+		acia_last = clockticks6502;
+
+		struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+		if (poll(&pfd, 1, 0) > 0) {
+			uint8_t c;
+			if (read(STDIN_FILENO, &c, 1) != 1) {
+				acia_eof = 1;
+			} else if (!simcommand(c)) {
+				acia_data = c == '\n' ? '\r' : c;
+				acia_status |= ACIA_STATUS_RDRF | ACIA_STATUS_IRQ;
+			}
+		}
+	}
+
+	if ((acia_status & ACIA_STATUS_IRQ) != 0 && (acia_command & 0x03) == 0x01 && (status & FLAG_INTERRUPT) == 0) {
+		if (cpu816) {
+			irq65816();
+		} else {
+			irq6502();
+		}
+		clockticks6502 += 7;
+	}
+}
+
+uint8_t read6502(uint32_t address) {
 	if (address == STDIO) {
 		for (;;) {
-			int c = (uint8_t)getchar();
-			switch (c) {
-			case '`':
-				printf("6502 cycles: %d\n", clockticks6502);
-				printf("6502 instrs: %d\n", instructions);
-				printf("RISCV instrs: %d\n", riscv_instructions);
-				break;
-			case '~':
-				for (int i = 0; i < 65536; i++) {
-					if (profile[i] != 0) {
-						fprintf(stderr, "%04x,%u,%llu\n", i, profile[i], cycles[i]);
-					}
-				}
-				break;
-			default:
+			uint8_t c;
+			if (read(STDIN_FILENO, &c, 1) != 1) {
+				// Nothing more will ever arrive: stop the machine rather than spinning.
+				halted = 1;
+				return 0;
+			}
+			if (!simcommand(c)) {
 				if (c == '\n') {
 					c = '\r';
 				}
 				return c | 0x80;
 			}
 		}
+	} else if (address == BLK_CMD) {
+		return blk_status;
 	} else if (address == INST) {
 		riscv_instruction_trapped = 1;
 		riscv_instructions++;
+	} else if (address == ACIA_DATA) {
+		acia_status &= ~ACIA_STATUS_RDRF;
+		return acia_data;
+	} else if (address == ACIA_STATUS) {
+		uint8_t s = acia_status;
+		acia_status &= ~ACIA_STATUS_IRQ;
+		if ((s & ACIA_STATUS_RDRF) == 0 && acia_eof) {
+			// The program is polling for input that will never arrive.
+			halted = 1;
+		}
+		return s;
+	} else if (address == ACIA_COMMAND) {
+		return acia_command;
 	} else if (address < 0x100) {
 //		printf("rd zp 0x%02x: %02x\n", address, memory[address]);
 	}
 	return memory[address];
 }
 
-void write6502(uint16_t address, uint8_t value) {
+void write6502(uint32_t address, uint8_t value) {
 	if (address == STDIO) {
 		int c = (int)(value & 0x7f);
 		if (c == '\r') {
@@ -1054,6 +2101,12 @@ void write6502(uint16_t address, uint8_t value) {
 		}
 		putchar(c);
 		return;
+	} else if (address == ACIA_COMMAND) {
+		acia_command = value;
+		return;
+	} else if (address == BLK_CMD) {
+		blk_command(value);
+		return;
 	} else if (address == TRAP) {
 //		uint32_t* vs = (uint32_t*)memory;
 //		uint32_t vin = vs[vs[0] >> 2];
@@ -1076,28 +2129,48 @@ void write6502(uint16_t address, uint8_t value) {
 }
 
 void handle_sigint(int _) {
-	kill = 1;
+	halted = 1;
 }
 
 int main(int argc, char *argv[]) {
 	// reset the RISCV instruction count
 	riscv_instructions = 0;
 
+	// `-816` selects the 65C816 core.
+	int argi = 1;
+	if (argi < argc && strcmp(argv[argi], "-816") == 0) {
+		cpu816 = 1;
+		argi++;
+	}
+	// `-disk file` backs the block device with file.
+	if (argi + 1 < argc && strcmp(argv[argi], "-disk") == 0) {
+		disk_path = argv[argi + 1];
+		argi += 2;
+	}
+	if (argi >= argc) {
+		fprintf(stderr, "usage: %s [-816] [-disk file] image\n", argv[0]);
+		return -1;
+	}
+
 	// jam random bytes into memory
+#ifdef __APPLE__
 	sranddev();
-	for (int i = 0; i < 65536; i++) {
+#else
+	srand((unsigned)time(NULL) ^ (unsigned)getpid());
+#endif
+	for (size_t i = 0; i < sizeof(memory); i++) {
 		memory[i] = (uint8_t)rand();
 	}
 
-	int prog = open(argv[1], O_RDONLY);
+	int prog = open(argv[argi], O_RDONLY);
 	if (prog == -1) {
-		fprintf(stderr, "failed to open %s\n", argv[1]);
+		fprintf(stderr, "failed to open %s\n", argv[argi]);
 		return -1;
 	}
 
 	// read in each chunk until EOF
 	ssize_t offset = 0x803;
-	ssize_t n = read(prog, &memory[offset], sizeof(memory) - offset);
+	ssize_t n = read(prog, &memory[offset], 0x10000 - offset);
 	if (n <= 0) {
 		fprintf(stderr, "failed to read program\n");
 		return -1;
@@ -1126,27 +2199,45 @@ int main(int argc, char *argv[]) {
 		cycles[i] = 0;
 	}
 
+#ifdef __APPLE__
 	// init delay info
 	mach_timebase_info_data_t info;
 	mach_timebase_info(&info);
+#endif
 
-	kill = 0;
+	halted = 0;
 	signal(SIGINT, handle_sigint);
 
 	// run the program!
 	reset6502();
+	if (cpu816) {
+		reset65816();
+	}
 	profile[pc]++;
 	subroutine_stack[current_subroutine] = pc;
-	while ((status & FLAG_INTERRUPT) == 0 && !kill) {
+	while (!halted) {
+		acia_tick();
+
+#ifdef __APPLE__
 		uint64_t s = mach_absolute_time();
+#endif
 		uint32_t st = clockticks6502;
-		uint8_t opc = memory[pc];
+		uint8_t opc = memory[cpu816 ? ((uint32_t)pbr816 << 16) | pc : pc];
 
 		riscv_instruction_trapped = 0;
 
 		//fprintf(stderr, "pc: 0x%04x, opc: %02x %s, a: 0x%02x, x: 0x%02x, y: 0x%02x, s: 0x%02x, p: 0x%02x\n", pc, opc, opnames[opc], a, x, y, sp, status);
 		//fflush(stderr);
-		step6502();
+		if (cpu816) {
+			step65816();
+		} else {
+			step6502();
+		}
+
+		// The interpreter halts with a BRK. Now that interrupts are in use, the I flag alone no longer means we're done.
+		if (opc == 0x00) {
+			break;
+		}
 
 		if(riscv_instruction_trapped) {
 			instructions--;
@@ -1,3 +1,4 @@
+#include <stdarg.h>
 #include <stdint.h>
 
 uint32_t syscall(uint32_t addr, uint32_t arg);
@@ -7,32 +8,219 @@ void cout(char c) {
 	syscall(couta, (uint32_t)c);
 }
 
+// Input goes through the interpreter's interrupt-driven ring buffer (core/input.s) rather than the ROM's RDKEY, so
+// bytes that arrive while the program is busy are buffered instead of dropped.
 char rdkey() {
-	const uint32_t rdkeya = 0xfd0c;
-	return (char)syscall(rdkeya, 0);
+	const uint32_t kbgetca = 0x080c;
+	return (char)syscall(kbgetca, 0);
 }
 
-void puts(char* s) {
+char kbpoll() {
+	const uint32_t kbpolla = 0x0806;
+	return (char)syscall(kbpolla, 0);
+}
+
+int kbread(char* buf, int n) {
+	const uint32_t kbreada = 0x0809;
+	// n is passed in Y, byte 2 of the ecall argument, so it must stay within 0..255: anything outside that range would
+	// spill into byte 3, which opsystem loads into P.
+	if (n < 0) {
+		n = 0;
+	} else if (n > 255) {
+		n = 255;
+	}
+	return (int)(syscall(kbreada, ((uint32_t)buf & 0xffff) | ((uint32_t)n << 16)) & 0xff);
+}
+
+// sim6502's block device copies memory to and from the host file named by its -disk flag. A transfer takes an
+// address and a length in BLK_ADDR and BLK_LEN, and starts when the command is written to BLK_CMD; reading BLK_CMD
+// back gives 0 if it succeeded. Transfers are sequential from the last blkopen. There is no such device on real
+// hardware.
+#define BLK_ADDR ((volatile uint8_t*)0xe010)
+#define BLK_LEN ((volatile uint8_t*)0xe012)
+#define BLK_CMD ((volatile uint8_t*)0xe014)
+
+enum {
+	BLK_CREATE = 1,
+	BLK_OPEN = 2,
+	BLK_WRITE = 3,
+	BLK_READ = 4,
+};
+
+static int blkcmd(int cmd, uint32_t addr, unsigned n) {
+	BLK_ADDR[0] = addr & 0xff;
+	BLK_ADDR[1] = (addr >> 8) & 0xff;
+	BLK_LEN[0] = n & 0xff;
+	BLK_LEN[1] = (n >> 8) & 0xff;
+	*BLK_CMD = cmd;
+	return *BLK_CMD == 0 ? 0 : -1;
+}
+
+// blkopen starts a new image, truncating the file if write is set. It returns 0 on success and -1 on failure.
+int blkopen(int write) {
+	return blkcmd(write ? BLK_CREATE : BLK_OPEN, 0, 0);
+}
+
+// blkwrite and blkread transfer n bytes in chunks that fit the 16-bit length register.
+static int blktransfer(int cmd, uint32_t addr, unsigned n) {
+	while (n > 0) {
+		unsigned chunk = n > 0x8000 ? 0x8000 : n;
+		if (blkcmd(cmd, addr, chunk) != 0) {
+			return -1;
+		}
+		addr += chunk;
+		n -= chunk;
+	}
+	return 0;
+}
+
+int blkwrite(const void* buf, unsigned n) {
+	return blktransfer(BLK_WRITE, (uint32_t)buf, n);
+}
+
+int blkread(void* buf, unsigned n) {
+	return blktransfer(BLK_READ, (uint32_t)buf, n);
+}
+
+void puts(const char* s) {
 	for (int i = 0; s[i] != '\0'; i++) {
 		cout(s[i] | 0x80);
 	}
 }
 
-void putint(int n) {
-	char buf[10]; // max 32-bit int is 10 decimal digits
-	int div = 10;
+// Numbers are formatted without dividing: RV32I has no divide instruction, and each call to __divsi3 or __modsi3
+// costs hundreds of instructions. Decimal digits come from subtracting powers of ten, and hex digits from shifts.
+static const uint32_t powers_of_ten[] = {
+	1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10,
+};
+
+static const char lower_digits[] = "0123456789abcdef";
+static const char upper_digits[] = "0123456789ABCDEF";
+
+// fmtuint writes n in decimal to buf, which needs room for 11 bytes, and returns the number of digits.
+int fmtuint(char* buf, uint32_t n) {
+	char* p = buf;
+	unsigned i = 0;
+	while (i < sizeof(powers_of_ten) / sizeof(powers_of_ten[0]) && n < powers_of_ten[i]) {
+		i++;
+	}
+	for (; i < sizeof(powers_of_ten) / sizeof(powers_of_ten[0]); i++) {
+		char d = '0';
+		while (n >= powers_of_ten[i]) {
+			n -= powers_of_ten[i];
+			d++;
+		}
+		*p++ = d;
+	}
+	*p++ = '0' + n;
+	*p = '\0';
+	return p - buf;
+}
+
+// fmtint writes n in decimal to buf, which needs room for 12 bytes, and returns the number of characters.
+int fmtint(char* buf, int n) {
 	if (n < 0) {
-		cout('-' | 0x80);
-		div = -10;
+		buf[0] = '-';
+		return 1 + fmtuint(buf + 1, -(uint32_t)n);
+	}
+	return fmtuint(buf, n);
+}
+
+static int fmtdigits(char* buf, uint32_t n, int ndigits, const char* digits) {
+	if (ndigits == 0) {
+		for (ndigits = 1; ndigits < 8 && (n >> (ndigits * 4)) != 0; ndigits++) {
+		}
+	}
+	for (int i = 0; i < ndigits; i++) {
+		buf[i] = digits[(n >> ((ndigits - 1 - i) * 4)) & 0xf];
 	}
+	buf[ndigits] = '\0';
+	return ndigits;
+}
+
+// fmthex writes the low ndigits hex digits of n in upper case to buf, which needs room for ndigits+1 bytes, or
+// as many digits as n needs if ndigits is 0. It returns the number of digits.
+int fmthex(char* buf, uint32_t n, int ndigits) {
+	return fmtdigits(buf, n, ndigits, upper_digits);
+}
+
+void putint(int n) {
+	char buf[12];
+	fmtint(buf, n);
+	puts(buf);
+}
+
+// printf understands %d, %u, %x, %X, %c, %s and %%, each with an optional 0 flag and width, which is all the
+// programs here print.
+void printf(const char* fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+
+	for (; *fmt != '\0'; fmt++) {
+		if (*fmt != '%') {
+			cout(*fmt | 0x80);
+			continue;
+		}
+		fmt++;
 
-	int i = 0;
-	do {
-		buf[i++] = '0' + (n % div);
-		n /= div;
-	} while (n != 0);
+		char pad = ' ';
+		if (*fmt == '0') {
+			pad = '0';
+			fmt++;
+		}
+		int width = 0;
+		for (; *fmt >= '0' && *fmt <= '9'; fmt++) {
+			width = (width << 3) + (width << 1) + (*fmt - '0');
+		}
 
-	while (i > 0) {
-		cout(buf[--i] | 0x80);
+		char buf[12];
+		const char* s = buf;
+		int len;
+		switch (*fmt) {
+		case 'd':
+			len = fmtint(buf, va_arg(ap, int));
+			break;
+		case 'u':
+			len = fmtuint(buf, va_arg(ap, uint32_t));
+			break;
+		case 'x':
+			len = fmtdigits(buf, va_arg(ap, uint32_t), 0, lower_digits);
+			break;
+		case 'X':
+			len = fmtdigits(buf, va_arg(ap, uint32_t), 0, upper_digits);
+			break;
+		case 'c':
+			buf[0] = (char)va_arg(ap, int);
+			len = 1;
+			break;
+		case 's':
+			s = va_arg(ap, const char*);
+			for (len = 0; s[len] != '\0'; len++) {
+			}
+			break;
+		case '\0':
+			fmt--;
+			// fall through
+		default:
+			buf[0] = *fmt;
+			len = 1;
+			break;
+		}
+
+		// Zeros go after the sign.
+		if (pad == '0' && s == buf && buf[0] == '-') {
+			cout('-' | 0x80);
+			s++;
+			len--;
+			width--;
+		}
+		for (; width > len; width--) {
+			cout(pad | 0x80);
+		}
+		for (int i = 0; i < len; i++) {
+			cout(s[i] | 0x80);
+		}
 	}
+
+	va_end(ap);
 }
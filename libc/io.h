@@ -1,7 +1,22 @@
 #ifndef __IO_H__
 #define __IO_H__
 
+#include <stdint.h>
+
 void cout(char c);
 char rdkey();
+char kbpoll();
+int kbread(char* buf, int n);
+
+void puts(const char* s);
+void putint(int n);
+int fmtuint(char* buf, uint32_t n);
+int fmtint(char* buf, int n);
+int fmthex(char* buf, uint32_t n, int ndigits);
+void printf(const char* fmt, ...);
+
+int blkopen(int write);
+int blkwrite(const void* buf, unsigned n);
+int blkread(void* buf, unsigned n);
 
 #endif
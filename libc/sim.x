@@ -7,4 +7,10 @@ SECTIONS
   .srodata : { *(.srodata) }
   .bss : { *(.bss) }
   .sbss : { *(.sbss) }
+  /* Free RAM runs from _end up to the stack reserve below STACK_TOP (0xc000).
+     The reserve is 4K unless the program defines a larger _stack_reserve. */
+  . = ALIGN(8);
+  _end = .;
+  _stack_limit = 0xc000 - (DEFINED(_stack_reserve) ? _stack_reserve : 0x1000);
+  ASSERT(_end <= _stack_limit, "program overflows the window")
 }
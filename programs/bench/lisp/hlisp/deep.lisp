@@ -0,0 +1,5 @@
+(DEFINE IOTA (LAMBDA (N ACC) (IF (EQ N 0) ACC (IOTA (MINUS N 1) (CONS N ACC)))))
+(DEFINE COPY (LAMBDA (L) (IF L (CONS (CAR L) (COPY (CDR L))) NIL)))
+(DEFINE DEPTH (LAMBDA (L) (IF L (PLUS 1 (DEPTH (CDR L))) 0)))
+(DEFINE REPEAT (LAMBDA (N L) (IF (EQ N 0) (DEPTH L) (REPEAT (MINUS N 1) (COPY L)))))
+(REPEAT 20 (IOTA 64 NIL))
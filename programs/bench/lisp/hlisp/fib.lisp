@@ -0,0 +1,2 @@
+(DEFINE FIB (LAMBDA (N) (IF (LESSP N 2) N (PLUS (FIB (MINUS N 1)) (FIB (MINUS N 2))))))
+(FIB 15)
@@ -0,0 +1,4 @@
+(DEFINE OK (LAMBDA (ROW DIST PLACED) (IF PLACED (IF (EQ ROW (CAR PLACED)) NIL (IF (EQ ROW (PLUS (CAR PLACED) DIST)) NIL (IF (EQ (PLUS ROW DIST) (CAR PLACED)) NIL (OK ROW (PLUS DIST 1) (CDR PLACED))))) T)))
+(DEFINE QUEENS (LAMBDA (N K PLACED) (IF (EQ K N) 1 (TRY N K PLACED 0 0))))
+(DEFINE TRY (LAMBDA (N K PLACED ROW ACC) (IF (EQ ROW N) ACC (TRY N K PLACED (PLUS ROW 1) (IF (OK ROW 1 PLACED) (PLUS (QUEENS N (PLUS K 1) (CONS ROW PLACED)) ACC) ACC)))))
+(QUEENS 6 0 NIL)
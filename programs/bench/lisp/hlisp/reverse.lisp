@@ -0,0 +1,6 @@
+(DEFINE IOTA (LAMBDA (N ACC) (IF (EQ N 0) ACC (IOTA (MINUS N 1) (CONS N ACC)))))
+(DEFINE REV (LAMBDA (L ACC) (IF L (REV (CDR L) (CONS (CAR L) ACC)) ACC)))
+(DEFINE APPEND (LAMBDA (A B) (IF A (CONS (CAR A) (APPEND (CDR A) B)) B)))
+(DEFINE INNER (LAMBDA (N L) (IF (EQ N 0) L (INNER (MINUS N 1) (REV (APPEND L NIL) NIL)))))
+(DEFINE OUTER (LAMBDA (N L) (IF (EQ N 0) L (OUTER (MINUS N 1) (INNER 16 L)))))
+(OUTER 16 (IOTA 16 NIL))
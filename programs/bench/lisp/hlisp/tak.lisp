@@ -0,0 +1,2 @@
+(DEFINE TAK (LAMBDA (X Y Z) (IF (LESSP Y X) (TAK (TAK (MINUS X 1) Y Z) (TAK (MINUS Y 1) Z X) (TAK (MINUS Z 1) X Y)) Z)))
+(TAK 9 6 1)
@@ -0,0 +1,90 @@
+#!/bin/sh
+# Runs each benchmark in hlisp/ and ulisp/ under sim6502 and reports the 6502 cycles, RISC-V instructions, collections
+# and allocations it took, compared with the stored baseline. Run it from the top of the tree after `make bin/sim6502
+# bin/hlisp.sim.img bin/ulisp.sim.img`, or through `make bench-lisp`.
+#
+#   run.sh         compare with baseline.txt, and fail if it is missing, or if a benchmark errs or runs more than
+#                  THRESHOLD% more cycles
+#   run.sh -u      record the results as the new baseline.txt
+#
+# The two directories hold the same workloads written for each dialect. ulisp has no numbers, so its versions count
+# in unary with lists. deep.lisp recurses 64 calls deep on hlisp, as far as its VM call stack allows, and 24 on ulisp,
+# whose eval recursion runs in the C stack reserve (STACKRESERVE in ulisp.c) and stops with STACK FULL beyond it.
+
+dir=$(dirname "$0")
+sim=${SIM:-bin/sim6502}
+baseline=$dir/baseline.txt
+threshold=${THRESHOLD:-2}
+
+update=0
+if [ "$1" = "-u" ]; then
+	update=1
+fi
+
+# Without a baseline nothing can be compared, so a regression would pass unnoticed.
+if [ $update -eq 0 ] && [ ! -f "$baseline" ]; then
+	echo "no $baseline; run $0 -u to record one" >&2
+	exit 1
+fi
+
+results=$(mktemp)
+trap 'rm -f "$results"' EXIT
+
+failed=0
+for lisp in hlisp ulisp; do
+	for f in "$dir"/$lisp/*.lisp; do
+		name=$lisp/$(basename "$f" .lisp)
+		# sim6502 exits with the 6502's A register, so its status means nothing here.
+		out=$( (cat "$f"; echo "(STATS)") | "$sim" bin/$lisp.sim.img)
+		# hlisp reports errors with ***, ulisp with ERROR:.
+		if echo "$out" | grep -q '\*\*\*\|ERROR:'; then
+			echo "$name: failed" >&2
+			echo "$out" | grep '\*\*\*\|ERROR:' >&2
+			failed=1
+			continue
+		fi
+		echo "$out" | awk -v name="$name" '
+			/^GCS:/ { gcs = $2 }
+			/^ALLOCS:/ { allocs = $2 }
+			/^6502 cycles:/ { cycles = $3 }
+			/^RISCV instrs:/ { instrs = $3 }
+			END { print name, cycles, instrs, gcs, allocs }' >>"$results"
+	done
+done
+
+if [ $update -eq 1 ]; then
+	cp "$results" "$baseline"
+	echo "recorded $baseline"
+	exit $failed
+fi
+
+# Joins the results with the baseline by name and prints each measure with its change in percent.
+awk -v threshold="$threshold" -v baseline="$baseline" '
+	function delta(now, was) {
+		if (was == "" || was == 0) {
+			return sprintf("%10d         ", now)
+		}
+		return sprintf("%10d %+7.1f%%", now, (now - was) * 100 / was)
+	}
+	BEGIN {
+		while ((getline line <baseline) > 0) {
+			split(line, f)
+			cycles[f[1]] = f[2]; instrs[f[1]] = f[3]; gcs[f[1]] = f[4]; allocs[f[1]] = f[5]
+		}
+		printf "%-16s %18s %18s %18s %18s\n", "benchmark", "6502 cycles", "RISC-V instrs", "GCs", "allocs"
+	}
+	{
+		printf "%-16s %s %s %s %s\n", $1, delta($2, cycles[$1]), delta($3, instrs[$1]), delta($4, gcs[$1]),
+			delta($5, allocs[$1])
+		if (cycles[$1] != "" && ($2 - cycles[$1]) * 100 > threshold * cycles[$1]) {
+			slower = slower " " $1
+		}
+	}
+	END {
+		if (slower != "") {
+			print "slower than the baseline by more than " threshold "%:" slower
+			exit 1
+		}
+	}' "$results" || failed=1
+
+exit $failed
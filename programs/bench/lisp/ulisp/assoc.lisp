@@ -0,0 +1,6 @@
+(DEFVAR ALIST '((A AA) (B BB) (C CC) (D DD) (E EE) (F FF) (G GG) (H HH) (I II) (J JJ) (K KK) (L LL) (M MM) (N NN) (O OO) (P PP) (Q QQ) (R RR) (S SS) (T TT) (U UU) (V VV) (W WW) (X XX) (Y YY) (Z ZZ) (AB AC) (BC BD) (CD CE) (DE DF) (EF EG) (FG FH)))
+(DEFVAR KEYS '(A B C D E F G H I J K L M N O P Q R S T U V W X Y Z AB BC CD DE EF FG))
+(DEFUN ASSOC (K A) (IF A (IF (EQ K (CAR (CAR A))) (CAR A) (ASSOC K (CDR A))) NIL))
+(DEFUN LOOKUPS (KS ACC) (IF KS (LOOKUPS (CDR KS) (CAR (CDR (ASSOC (CAR KS) ALIST)))) ACC))
+(DEFUN REPEAT (N ACC) (IF (NULL N) ACC (REPEAT (CDR N) (LOOKUPS KEYS ACC))))
+(REPEAT '(X X X X X X X X X X X X X X X X) NIL)
@@ -0,0 +1,3 @@
+(DEFUN COPY (L) (IF L (CONS (CAR L) (COPY (CDR L))) NIL))
+(DEFUN REPEAT (N L) (IF (NULL N) L (REPEAT (CDR N) (COPY L))))
+(REPEAT '(X X X X X X X X X X X X X X X X X X X X) '(A B C D E F G H I J K L M N O P Q R S T U V W X))
@@ -0,0 +1,3 @@
+(DEFUN ADD (A B) (IF (NULL A) B (ADD (CDR A) (CONS (CAR A) B))))
+(DEFUN FIB (N) (IF (NULL N) NIL (IF (NULL (CDR N)) N (ADD (FIB (CDR N)) (FIB (CDR (CDR N)))))))
+(FIB '(X X X X X X X X X X X X X X X))
@@ -0,0 +1,7 @@
+(DEFUN ADD (A B) (IF (NULL A) B (ADD (CDR A) (CONS (CAR A) B))))
+(DEFUN EQN (A B) (IF (NULL A) (NULL B) (IF (NULL B) NIL (EQN (CDR A) (CDR B)))))
+(DEFUN EQSUM (A B D) (IF (NULL B) (EQN A D) (IF (NULL A) NIL (EQSUM (CDR A) (CDR B) D))))
+(DEFUN OK (ROW DIST PLACED) (IF (NULL PLACED) T (IF (EQN ROW (CAR PLACED)) NIL (IF (EQSUM ROW (CAR PLACED) DIST) NIL (IF (EQSUM (CAR PLACED) ROW DIST) NIL (OK ROW (CONS 'X DIST) (CDR PLACED)))))))
+(DEFUN QUEENS (N K PLACED) (IF (EQN K N) '(X) (TRY N K PLACED NIL NIL)))
+(DEFUN TRY (N K PLACED ROW ACC) (IF (EQN ROW N) ACC (TRY N K PLACED (CONS 'X ROW) (IF (OK ROW '(X) PLACED) (ADD (QUEENS N (CONS 'X K) (CONS ROW PLACED)) ACC) ACC))))
+(QUEENS '(X X X X X X) NIL NIL)
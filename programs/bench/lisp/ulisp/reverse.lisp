@@ -0,0 +1,6 @@
+(DEFVAR SIXTEEN '(A B C D E F G H I J K L M N O P))
+(DEFUN REV (L ACC) (IF L (REV (CDR L) (CONS (CAR L) ACC)) ACC))
+(DEFUN APPEND (A B) (IF A (CONS (CAR A) (APPEND (CDR A) B)) B))
+(DEFUN INNER (N L) (IF (NULL N) L (INNER (CDR N) (REV (APPEND L NIL) NIL))))
+(DEFUN OUTER (N L) (IF (NULL N) L (OUTER (CDR N) (INNER SIXTEEN L))))
+(OUTER SIXTEEN SIXTEEN)
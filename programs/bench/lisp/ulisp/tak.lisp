@@ -0,0 +1,3 @@
+(DEFUN LESSP (A B) (IF (NULL B) NIL (IF (NULL A) T (LESSP (CDR A) (CDR B)))))
+(DEFUN TAK (X Y Z) (IF (LESSP Y X) (TAK (TAK (CDR X) Y Z) (TAK (CDR Y) Z X) (TAK (CDR Z) X Y)) Z))
+(TAK '(X X X X X X X X X) '(X X X X X X) '(X))
@@ -0,0 +1,71 @@
+// muldiv measures libc's software multiply and divide, for `make bench-muldiv`. It reads one command character, then
+// applies that operation to each pair in its operand table REPEAT times and prints how many calls it made:
+//
+//     *  __mulsi3      /  __divsi3      %  __modsi3      u  __udivsi3      .  nothing
+//
+// The . run goes through the same loop without calling anything, so subtracting its RISC-V instructions from
+// another run's leaves what that run's calls cost.
+
+#include <stdint.h>
+
+char rdkey();
+void printf(const char* fmt, ...);
+
+#define REPEAT 8
+
+// Small operands, as most programs here use, along with large and negative ones and powers of two. Not static, so
+// that the compiler cannot fold the calls away.
+int32_t operands[][2] = {
+    { 7, 3 },
+    { 10, 10 },
+    { 100, 7 },
+    { 1000, 10 },
+    { 255, 16 },
+    { 4096, 2 },
+    { 12345, 100 },
+    { 65535, 255 },
+    { 1000000, 10 },
+    { 1000000, 1024 },
+    { 123456789, 1000 },
+    { 2147483647, 3 },
+    { -100, 7 },
+    { 1000, -3 },
+    { -65536, -256 },
+    { 3, 123456 },
+};
+
+#define NOPERANDS (sizeof(operands) / sizeof(operands[0]))
+
+volatile int32_t result;
+
+int main() {
+    char op = rdkey() & 0x7f;
+    unsigned calls = 0;
+
+    for (int r = 0; r < REPEAT; r++) {
+        for (unsigned i = 0; i < NOPERANDS; i++) {
+            int32_t a = operands[i][0], b = operands[i][1];
+            switch (op) {
+            case '*':
+                // Multiplied unsigned, since the large pairs overflow.
+                result = (uint32_t)a * (uint32_t)b;
+                break;
+            case '/':
+                result = a / b;
+                break;
+            case '%':
+                result = a % b;
+                break;
+            case 'u':
+                result = (uint32_t)a / (uint32_t)b;
+                break;
+            default:
+                result = a ^ b;
+                break;
+            }
+            calls++;
+        }
+    }
+    printf("CALLS: %u\r", calls);
+    return 0;
+}
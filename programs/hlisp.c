@@ -6,56 +6,104 @@ void cout(char c);
 char rdkey();
 void puts(const char* s);
 void putint(int i);
+int fmthex(char* buf, uint32_t n, int ndigits);
+void printf(const char* fmt, ...);
+int blkopen(int write);
+int blkwrite(const void* buf, unsigned n);
+int blkread(void* buf, unsigned n);
 
 #define NULL 0
 
 #define LISP_NIL     ((Value*)1)
 #define LISP_NILP(v) ((Value*)v == LISP_NIL)
 
-#define CAR(v)   ((v)->pair.car)
-#define CDR(v)   ((v)->pair.cdr)
-#define CAAR(v)  ((v)->pair.car->pair.car)
-#define CADR(v)  ((v)->pair.cdr->pair.car)
-#define CDAR(v)  ((v)->pair.car->pair.cdr)
-#define CDDR(v)  ((v)->pair.cdr->pair.cdr)
-#define CAAAR(v) ((v)->pair.car->pair.car->pair.car)
-#define CAADR(v) ((v)->pair.cdr->pair.car->pair.car)
-#define CADAR(v) ((v)->pair.car->pair.cdr->pair.car)
-#define CADDR(v) ((v)->pair.cdr->pair.cdr->pair.car)
-#define CDAAR(v) ((v)->pair.car->pair.car->pair.cdr)
-#define CDADR(v) ((v)->pair.cdr->pair.car->pair.cdr)
-#define CDDAR(v) ((v)->pair.car->pair.cdr->pair.cdr)
-#define CDDDR(v) ((v)->pair.cdr->pair.cdr->pair.cdr)
+// Small integers are stored in the pointer itself, shifted left by two with
+// the low bits set to 10. Heap objects are word-aligned, so their low bits are
+// always 00, and LISP_NIL's are 01. Integers outside the fixnum range, and
+// integers flagged F_HEX, are boxed on the heap as T_INT values.
+#define FIXNUM_MIN      (-(1 << 29))
+#define FIXNUM_MAX      ((1 << 29) - 1)
+#define LISP_FIXNUMP(v) (((uintptr_t)(v) & 3) == 2)
+#define MKFIXNUM(i)     ((Value*)(((uintptr_t)(i) << 2) | 2))
+#define FIXNUM_VALUE(v) ((int)((intptr_t)(v) >> 2))
+#define INTVAL(v)       (LISP_FIXNUMP(v) ? FIXNUM_VALUE(v) : (v)->int_)
+
+#define CAR(v)   (((Pair *)(v))->car)
+#define CDR(v)   (((Pair *)(v))->cdr)
+#define CAAR(v)  CAR(CAR(v))
+#define CADR(v)  CAR(CDR(v))
+#define CDAR(v)  CDR(CAR(v))
+#define CDDR(v)  CDR(CDR(v))
+#define CAAAR(v) CAR(CAR(CAR(v)))
+#define CAADR(v) CAR(CAR(CDR(v)))
+#define CADAR(v) CAR(CDR(CAR(v)))
+#define CADDR(v) CAR(CDR(CDR(v)))
+#define CDAAR(v) CDR(CAR(CAR(v)))
+#define CDADR(v) CDR(CAR(CDR(v)))
+#define CDDAR(v) CDR(CDR(CAR(v)))
+#define CDDDR(v) CDR(CDR(CDR(v)))
 
 typedef struct value {
     uint8_t type;
     uint8_t flags;
+    uint16_t fwd; // heap offset of the object after compaction; see gc()
     union {
         int int_;
-        char sym[1];
-        struct value* (*fn)(struct value*);
         struct {
-            struct value *args;
-            struct value *body;
+            struct value *value; // global value, or NULL if unbound
+            struct value *next;  // next symbol in the same hash bucket
+            uint8_t length;
+            char name[1];
+        } sym;
+        // Natives take their arguments in place on the VM stack.
+        struct value* (*fn)(struct value **args, int nargs);
+        struct {
+            struct value *code;
             struct value *env;
         } lambda;
         struct {
-          struct value *car;
-          struct value *cdr;
-        } pair;
+            uint8_t nargs;
+            uint8_t maxstack; // VM stack slots used by the code
+            uint16_t nconsts;
+            uint16_t nbytes;
+            struct value *consts[1]; // followed by the bytecode
+        } code;
+        struct {
+            struct value *parent;
+            int nslots;
+            struct value *slots[1];
+        } frame;
     };
 } Value;
 
+// Pairs live in their own space as bare car/cdr cells with no header; a
+// pointer into pair_mem is a pair. See gettype().
+typedef struct pair {
+    Value *car;
+    Value *cdr;
+} Pair;
+
+// The heap size of an object whose last field is f.
+#define VALUE_SIZE(f) ((size_t) &((Value *) 0)->f + sizeof(((Value *) 0)->f))
+#define SYM_SIZE(n)   HEAP_ALIGN((size_t) &((Value *) 0)->sym.name + (n) + 1)
+#define FRAME_SIZE(n) HEAP_ALIGN((size_t) &((Value *) 0)->frame.slots + (n) * sizeof(Value *))
+#define CODE_SIZE(nconsts, nbytes) \
+    HEAP_ALIGN((size_t) &((Value *) 0)->code.consts + (nconsts) * sizeof(Value *) + (nbytes))
+#define CODE_BYTES(v) ((uint8_t *) &(v)->code.consts[(v)->code.nconsts])
+
 typedef enum type {
     T_INT,
     T_SYM,
     T_PAIR,
     T_NATIVE,
-    T_LAMBDA
+    T_LAMBDA,
+    T_FRAME,
+    T_CODE
 } Type;
 
 enum flags {
     F_HEX = 0x01,
+    F_MARK = 0x80,
 };
 
 // for peekchar and friends.
@@ -90,31 +138,108 @@ char ungetc(char c) {
     lastchar = c;
 }
 
-char heap_mem[16384];
+// Objects are allocated in multiples of 4 bytes so that their fields stay
+// word-aligned.
+#define HEAP_ALIGN(n) (((n) + 3) & ~3)
+
+// Memory budget. The program, its data and the C stack reserve all share the
+// 32K window from $4000 to STACK_TOP ($c000), and libc/sim.x fails the link if
+// they overflow it. The compiler and VM take about 18K of code, and the stack
+// reserve 4K, which leaves roughly 10K for the arrays below: 3K of heap, 3.5K
+// of pairs, and 3K for the VM's stacks, the compiler's buffers and the
+// symbol table. Growing any of them means shrinking another.
+
+// Symbols, lambdas, call frames, natives and boxed integers.
+char heap_mem[3072] __attribute__((aligned(4)));
 char *heap; // grows up
 char *heap_end;
 
-#define SYMBOL_TABLE_SIZE 255
+// Pairs. The pair space takes a little more memory than the heap, since most
+// of what a Lisp program allocates is conses, but the heap also holds every
+// live call's argument frame.
+#define PAIR_SPACE_SIZE 448
+Pair pair_mem[PAIR_SPACE_SIZE] __attribute__((aligned(8)));
+Pair *pairs; // grows up
+Pair *pairs_end;
+
+// Pairs have no flags byte, so the collector marks them in a bitmap.
+uint8_t pair_marks[PAIR_SPACE_SIZE / 8];
+
+#define PAIRP(v) (((uintptr_t)(v) & 3) == 0 && (Pair *)(v) >= pair_mem && (Pair *)(v) < pairs_end)
+
+
+// Shadow stack of the addresses of C locals that hold heap pointers across
+// an allocation. The collector moves objects, so these locals are treated as
+// roots and updated in place. Anything else that may be live across a call
+// that allocates must be reloaded from a root afterwards.
+#define ROOT_STACK_SIZE 64
+Value **roots[ROOT_STACK_SIZE];
+int nroots;
+
+#define PUSH_ROOT(v) (nroots < ROOT_STACK_SIZE ? (void)(roots[nroots++] = &(v)) : error("Too deep."))
+#define POP_ROOTS(n) (nroots -= (n))
+
+// The VM's value stack, and its stack of suspended calls. A call saves its
+// caller's pc as an offset because the collector may move the code.
+#define VM_STACK_SIZE 160
+Value *stack[VM_STACK_SIZE];
+int sp;
+
+typedef struct call {
+    Value *code;
+    Value *env;
+    int pc;
+} Call;
+
+#define CALL_STACK_SIZE 80
+Call calls[CALL_STACK_SIZE];
+int ncalls;
+
+// Scratch space for the compiler. A lambda nested in a form is compiled into
+// the space above its parent's and copied out into a code object when it is
+// finished, so both are used as stacks. The constants are roots.
+#define COMPILE_BYTES 512
+#define COMPILE_CONSTS 64
+uint8_t cbytes[COMPILE_BYTES];
+int nbytes;
+Value *cconsts[COMPILE_CONSTS];
+int nconsts;
+
+// Interned symbols, chained through sym.next. The size must be a power of two.
+#define SYMBOL_TABLE_SIZE 64
 Value *syms[SYMBOL_TABLE_SIZE];
 
 // Symbols for primitives. Initialized in init().
 Value *quote_sym = NULL,
       *lambda_sym = NULL,
       *define_sym = NULL,
-      *if_sym = NULL;
+      *if_sym = NULL,
+      *t_sym = NULL;
 
-// Global environment.
-Value *global_env;
+// Counts of collections and of objects allocated, reported by STATS.
+uint32_t ngcs;
+uint32_t nallocs;
 
 // Jump buffer for escaping a failing eval back to the top level.
 jmp_buf toplevel_escape;
 
+// Abandons whatever is running and returns to the top level.
+void toplevel()
+{
+    nroots = 0;
+    sp = 0;
+    ncalls = 0;
+    nbytes = 0;
+    nconsts = 0;
+    longjmp(toplevel_escape, 0);
+}
+
 void error(const char *what)
 {
     puts("*** ");
-       puts(what);
+    puts(what);
     putchar('\r');
-    longjmp(toplevel_escape, 0);
+    toplevel();
 }
 
 Value *mksym(const char *);
@@ -127,6 +252,8 @@ void init()
 
     heap = &heap_mem[0];
     heap_end = &heap_mem[sizeof(heap_mem)];
+    pairs = &pair_mem[0];
+    pairs_end = &pair_mem[PAIR_SPACE_SIZE];
 
     for (i = 0; i < SYMBOL_TABLE_SIZE; i++) {
         syms[i] = LISP_NIL;
@@ -136,45 +263,268 @@ void init()
     lambda_sym = mksym("LAMBDA");
     define_sym = mksym("DEFINE");
     if_sym = mksym("IF");
+    t_sym = mksym("T");
+}
+
+#define HEAPP(v) (((uintptr_t)(v) & 3) == 0 && (char *)(v) >= heap_mem && (char *)(v) < heap)
+
+#define PAIR_INDEX(v)       ((Pair *)(v) - pair_mem)
+#define PAIR_MARKED(i)      (pair_marks[(i) >> 3] & (1 << ((i) & 7)))
+#define SET_PAIR_MARK(i)    (pair_marks[(i) >> 3] |= 1 << ((i) & 7))
+
+size_t objsize(Value *p)
+{
+    switch (p->type) {
+    case T_SYM: return SYM_SIZE(p->sym.length);
+    case T_LAMBDA: return HEAP_ALIGN(VALUE_SIZE(lambda));
+    case T_FRAME: return FRAME_SIZE(p->frame.nslots);
+    case T_CODE: return CODE_SIZE(p->code.nconsts, p->code.nbytes);
+    case T_NATIVE: return HEAP_ALIGN(VALUE_SIZE(fn));
+    default: return HEAP_ALIGN(VALUE_SIZE(int_));
+    }
+}
+
+// Marks everything reachable from v, recursing on the car and looping on the
+// cdr so that long lists don't use up the stack.
+void mark(Value *v)
+{
+    for (;;) {
+        if (PAIRP(v)) {
+            size_t i = PAIR_INDEX(v);
+            if (PAIR_MARKED(i)) {
+                return;
+            }
+            SET_PAIR_MARK(i);
+            mark(CAR(v));
+            v = CDR(v);
+        } else if (HEAPP(v) && !(v->flags & F_MARK)) {
+            v->flags |= F_MARK;
+            switch (v->type) {
+            case T_SYM:
+                mark(v->sym.value);
+                v = v->sym.next;
+                break;
+            case T_LAMBDA:
+                mark(v->lambda.code);
+                v = v->lambda.env;
+                break;
+            case T_CODE:
+                {
+                    int i;
+                    for (i = 0; i < v->code.nconsts; i++) {
+                        mark(v->code.consts[i]);
+                    }
+                    return;
+                }
+            case T_FRAME:
+                {
+                    int i;
+                    for (i = 0; i < v->frame.nslots; i++) {
+                        mark(v->frame.slots[i]);
+                    }
+                    v = v->frame.parent;
+                } break;
+            default:
+                return;
+            }
+        } else {
+            return;
+        }
+    }
+}
 
-    // Set up the global environment as a single, "empty" binding.
-    // This is done so that we can "splice" global definitions into
-    // the global environment rather than "extending" the global
-    // environment in the regular fashion. Otherwise, global mutual
-    // recursion would not be possible.
-    global_env = mkpair(mkpair(LISP_NIL, LISP_NIL), LISP_NIL);
+// Returns v's address after collection. Pairs above the compacted pair space
+// have been moved and hold their new address in their car.
+Value *forward(Value *v)
+{
+    if (PAIRP(v)) {
+        return (Pair *) v >= pairs ? CAR(v) : v;
+    }
+    return HEAPP(v) ? (Value *) &heap_mem[v->fwd] : v;
 }
 
-void gc()
+// Mark-compact collection of both spaces. Afterwards each is again a single
+// bump region, so mkpair and friends don't change.
+//
+//   1. Mark everything reachable from the roots.
+//   2. Walk the object heap, assigning each marked object its compacted
+//      offset. Objects keep their allocation order.
+//   3. Compact the pair space with two fingers: live cells from the top fill
+//      the holes at the bottom, leaving a forwarding address behind.
+//   4. Rewrite the roots, the fields of every live pair and the fields of
+//      every marked object.
+//   5. Slide the marked objects down and clear the marks.
+void gc(size_t nalloc, size_t npairs)
 {
-    puts("Running gc\r");
+    char *p, *to;
+    size_t size, lo, hi;
+    int i;
+
+    ngcs++;
+    for (i = 0; i < SYMBOL_TABLE_SIZE; i++) {
+        mark(syms[i]);
+    }
+    for (i = 0; i < nroots; i++) {
+        mark(*roots[i]);
+    }
+    for (i = 0; i < sp; i++) {
+        mark(stack[i]);
+    }
+    for (i = 0; i < ncalls; i++) {
+        mark(calls[i].code);
+        mark(calls[i].env);
+    }
+    for (i = 0; i < nconsts; i++) {
+        mark(cconsts[i]);
+    }
+
+    to = heap_mem;
+    for (p = heap_mem; p < heap; p += size) {
+        Value *v = (Value *) p;
+        size = objsize(v);
+        if (v->flags & F_MARK) {
+            v->fwd = to - heap_mem;
+            to += size;
+        }
+    }
+
+    lo = 0;
+    hi = pairs - pair_mem;
+    for (;;) {
+        while (lo < hi && PAIR_MARKED(lo)) {
+            lo++;
+        }
+        while (lo < hi && !PAIR_MARKED(hi - 1)) {
+            hi--;
+        }
+        if (lo == hi) {
+            break;
+        }
+        hi--;
+        pair_mem[lo] = pair_mem[hi];
+        pair_mem[hi].car = (Value *) &pair_mem[lo];
+        lo++;
+    }
+    pairs = &pair_mem[lo];
+
+    quote_sym = forward(quote_sym);
+    lambda_sym = forward(lambda_sym);
+    define_sym = forward(define_sym);
+    if_sym = forward(if_sym);
+    t_sym = forward(t_sym);
+    for (i = 0; i < SYMBOL_TABLE_SIZE; i++) {
+        syms[i] = forward(syms[i]);
+    }
+    for (i = 0; i < nroots; i++) {
+        *roots[i] = forward(*roots[i]);
+    }
+    for (i = 0; i < sp; i++) {
+        stack[i] = forward(stack[i]);
+    }
+    for (i = 0; i < ncalls; i++) {
+        calls[i].code = forward(calls[i].code);
+        calls[i].env = forward(calls[i].env);
+    }
+    for (i = 0; i < nconsts; i++) {
+        cconsts[i] = forward(cconsts[i]);
+    }
+    for (lo = 0; &pair_mem[lo] < pairs; lo++) {
+        pair_mem[lo].car = forward(pair_mem[lo].car);
+        pair_mem[lo].cdr = forward(pair_mem[lo].cdr);
+    }
+    for (p = heap_mem; p < heap; p += size) {
+        Value *v = (Value *) p;
+        size = objsize(v);
+        if (!(v->flags & F_MARK)) {
+            continue;
+        }
+        switch (v->type) {
+        case T_SYM:
+            v->sym.value = forward(v->sym.value);
+            v->sym.next = forward(v->sym.next);
+            break;
+        case T_LAMBDA:
+            v->lambda.code = forward(v->lambda.code);
+            v->lambda.env = forward(v->lambda.env);
+            break;
+        case T_CODE:
+            {
+                int j;
+                for (j = 0; j < v->code.nconsts; j++) {
+                    v->code.consts[j] = forward(v->code.consts[j]);
+                }
+            } break;
+        case T_FRAME:
+            {
+                int j;
+                v->frame.parent = forward(v->frame.parent);
+                for (j = 0; j < v->frame.nslots; j++) {
+                    v->frame.slots[j] = forward(v->frame.slots[j]);
+                }
+            } break;
+        }
+    }
+
+    to = heap_mem;
+    for (p = heap_mem; p < heap; p += size) {
+        Value *v = (Value *) p;
+        size = objsize(v);
+        if (v->flags & F_MARK) {
+            uint32_t *src = (uint32_t *) p, *dest = (uint32_t *) to;
+            v->flags &= ~F_MARK;
+            for (i = 0; i < size / 4; i++) {
+                dest[i] = src[i];
+            }
+            to += size;
+        }
+    }
+    heap = to;
+    for (i = 0; i < sizeof(pair_marks); i++) {
+        pair_marks[i] = 0;
+    }
+
+    if (heap + nalloc > heap_end || pairs + npairs > pairs_end) {
+        error("Out of memory.");
+    }
 }
 
 void maybe_gc(size_t nalloc)
 {
-    if (heap + nalloc >= heap_end) {
-        gc();
+    if (heap + nalloc > heap_end) {
+        gc(nalloc, 0);
+    }
+}
+
+// Makes room for npairs pairs up front, so that a native can then build a
+// list with mkpair without anything moving underneath it.
+void reserve_pairs(size_t npairs)
+{
+    if (pairs + npairs > pairs_end) {
+        gc(0, npairs);
     }
 }
 
 Value *mkpair(Value *car, Value *cdr)
 {
-    Value *p;
-    const size_t nalloc = sizeof(Value);
+    Pair *p;
 
-    maybe_gc(nalloc);
-    p = (Value *) heap;
-    p->type = T_PAIR;
-    p->pair.car = car;
-    p->pair.cdr = cdr;
-    heap += nalloc;
-    return p;
+    if (pairs == pairs_end) {
+        PUSH_ROOT(car);
+        PUSH_ROOT(cdr);
+        gc(0, 1);
+        POP_ROOTS(2);
+    }
+    p = pairs++;
+    nallocs++;
+    p->car = car;
+    p->cdr = cdr;
+    return (Value *) p;
 }
 
-Value *mkint(int v)
+Value *mkboxed(int v)
 {
     Value *p;
-    const size_t nalloc = sizeof(Value);
+    const size_t nalloc = HEAP_ALIGN(VALUE_SIZE(int_));
 
     maybe_gc(nalloc);
     p = (Value *) heap;
@@ -182,75 +532,97 @@ Value *mkint(int v)
     p->flags = 0;
     p->int_ = v;
     heap += nalloc;
+    nallocs++;
     return p;
 }
 
+Value *mkint(int v)
+{
+    if (v >= FIXNUM_MIN && v <= FIXNUM_MAX) {
+        return MKFIXNUM(v);
+    }
+    return mkboxed(v);
+}
+
 Value *mkhex(int v)
 {
-    Value* p = mkint(v);
+    Value* p = mkboxed(v);
     p->flags = F_HEX;
     return p;
 }
 
-Value *mknative(Value* (*fn)(Value *))
+Value *mknative(Value* (*fn)(Value **, int))
 {
     Value *p;
-    const size_t nalloc = sizeof(Value);
+    const size_t nalloc = HEAP_ALIGN(VALUE_SIZE(fn));
 
     maybe_gc(nalloc);
     p = (Value *) heap;
     p->type = T_NATIVE;
+    p->flags = 0;
     p->fn = fn;
     heap += nalloc;
+    nallocs++;
     return p;
 }
 
-Value *mklambda(Value *args, Value *body, Value *env)
+Value *mklambda(Value *code, Value *env)
 {
     Value *p;
-    const size_t nalloc = sizeof(Value);
+    const size_t nalloc = HEAP_ALIGN(VALUE_SIZE(lambda));
 
-    maybe_gc(nalloc);
+    if (heap + nalloc > heap_end) {
+        PUSH_ROOT(code);
+        PUSH_ROOT(env);
+        gc(nalloc, 0);
+        POP_ROOTS(2);
+    }
     p = (Value *) heap;
     p->type = T_LAMBDA;
-    p->lambda.args = args;
-    p->lambda.body = body;
+    p->flags = 0;
+    p->lambda.code = code;
     p->lambda.env = env;
     heap += nalloc;
+    nallocs++;
     return p;
 }
 
-char tolower(char c) {
-    if (c >= 'A' && c <= 'Z') {
-        return c + 32;
-    }
-    return c;
-}
+// Allocates a call frame with nslots arguments, all NIL.
+Value *mkframe(int nslots, Value *parent)
+{
+    Value *p;
+    const size_t nalloc = FRAME_SIZE(nslots);
+    int i;
 
-int strcasecmp(const char* s0, const char *s1) {
-    int i = 0;
-    for (;;) {
-        char c0 = s0[i], c1 = s1[i];
-        if (c0 != c1) {
-            c0 = tolower(c0), c1 = tolower(c1);
-            if (c0 != c1) {
-                return c0 > c1;
-            }
-        }
-        if (c0 == '\0') {
-            return 0;
-        }
-        i++;
+    if (heap + nalloc > heap_end) {
+        PUSH_ROOT(parent);
+        gc(nalloc, 0);
+        POP_ROOTS(1);
     }
+    p = (Value *) heap;
+    p->type = T_FRAME;
+    p->flags = 0;
+    p->frame.parent = parent;
+    p->frame.nslots = nslots;
+    for (i = 0; i < nslots; i++) {
+        p->frame.slots[i] = LISP_NIL;
+    }
+    heap += nalloc;
+    nallocs++;
+    return p;
 }
 
-void strcpy(char* dest, const char* src) {
-    for (int i = 0; ; i++) {
-        dest[i] = src[i];
-        if (src[i] == '\0') {
-            break;
+int memcmp(const void *s0, const void *s1, size_t n)
+{
+    const uint8_t *b0 = s0, *b1 = s1;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (b0[i] != b1[i]) {
+            return b0[i] < b1[i] ? -1 : 1;
         }
     }
+    return 0;
 }
 
 size_t strlen(const char* c) {
@@ -261,46 +633,66 @@ size_t strlen(const char* c) {
     }
 }
 
-uint8_t gethash(const char *);
-Value *mksym(const char *sym)
+// FNV-1a. RV32I has no multiply instruction, so the multiply by the FNV
+// prime, 2^24 + 2^8 + 0x93, is written out as shifts and adds. The high half
+// is folded in because the table index only uses the low bits.
+uint32_t gethash(const char *name, size_t length)
 {
-    uint8_t hash = gethash(sym);
-    const size_t length = strlen(sym);
-    const size_t nalloc = sizeof(Value) + length + 1;
-    Value *pair, *prim;
+    uint32_t hash = 2166136261u;
+    size_t i;
 
-    pair = syms[hash];
-    for (; !LISP_NILP(pair); pair = CDR(pair)) {
-        Value *prim = CAR(pair);
-        if (strcasecmp(prim->sym, sym) == 0) {
-            return prim;
-        }
+    for (i = 0; i < length; i++) {
+        hash ^= (uint8_t) name[i];
+        hash += (hash << 1) + (hash << 4) + (hash << 7) + (hash << 8) + (hash << 24);
     }
-
-    maybe_gc(nalloc);
-    prim = (Value *) heap;
-    prim->type = T_SYM;
-    strcpy(prim->sym, sym);
-    heap += nalloc;
-    syms[hash] = mkpair(prim, syms[hash]);
-    return prim;
+    return hash ^ (hash >> 16);
 }
 
-uint8_t gethash(const char *sym)
+// Returns the symbol with the given name, creating it if necessary. Names
+// are case-folded by the reader, so the comparison is exact.
+Value *intern(const char *name, size_t length)
 {
-    uint8_t hash = 0;
-    const size_t length = strlen(sym);
+    Value **bucket = &syms[gethash(name, length) & (SYMBOL_TABLE_SIZE - 1)];
+    const size_t nalloc = SYM_SIZE(length);
+    Value *sym;
     size_t i;
 
+    for (sym = *bucket; !LISP_NILP(sym); sym = sym->sym.next) {
+        if (sym->sym.length == length && memcmp(sym->sym.name, name, length) == 0) {
+            return sym;
+        }
+    }
+
+    maybe_gc(nalloc);
+    sym = (Value *) heap;
+    sym->type = T_SYM;
+    sym->flags = 0;
+    sym->sym.value = NULL;
+    sym->sym.next = *bucket;
+    sym->sym.length = length;
     for (i = 0; i < length; i++) {
-        hash ^= tolower(sym[i]);
+        sym->sym.name[i] = name[i];
     }
-    // XXX: Alex says this blows. I think he's optimizing prematurely.
-    return hash;
+    sym->sym.name[length] = '\0';
+    heap += nalloc;
+    nallocs++;
+    *bucket = sym;
+    return sym;
+}
+
+Value *mksym(const char *name)
+{
+    return intern(name, strlen(name));
 }
 
 Type gettype(Value *ptr)
 {
+    if (LISP_FIXNUMP(ptr)) {
+        return T_INT;
+    }
+    if ((Pair *)ptr >= pair_mem && (Pair *)ptr < pairs_end) {
+        return T_PAIR;
+    }
     return ptr->type;
 }
 
@@ -308,6 +700,17 @@ int isalpha(char c) {
     return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
 }
 
+// Symbols are letters and the punctuation of the arithmetic and comparison
+// natives, so that (+ 1 2) and (<= a b) read.
+int issymbol(char c) {
+    switch (c) {
+    case '+': case '-': case '*': case '/':
+    case '<': case '>': case '=': case '!': case '?':
+        return 1;
+    }
+    return isalpha(c);
+}
+
 int isdigit(char c) {
     return (c >= '0' && c <= '9');
 }
@@ -316,20 +719,25 @@ int isspace(char c) {
     return c == ' ' || c == '\n' || c == '\r' || c == '\t';
 }
 
-Value *lreadsym()
+// Reads a symbol whose first character, ch, has already been read, folding it
+// to upper case.
+Value *lreadsym(char ch)
 {
     char buf[32];
-    char *p = buf;
-    char ch;
-    while (isalpha((ch = getchar()))) {
-        *p++ = ch;
-    }
+    size_t length = 0;
+    do {
+        if (ch >= 'a') {
+            ch -= 32;
+        }
+        if (length < sizeof(buf)) {
+            buf[length++] = ch;
+        }
+    } while (issymbol((ch = getchar())));
     ungetc(ch);
-    *p = '\0';
-    return mksym(buf);
+    return intern(buf, length);
 }
 
-Value *lreadint()
+Value *lreadint(int negative)
 {
     int v = 0;
     char ch;
@@ -337,7 +745,7 @@ Value *lreadint()
         v = v*10 + (ch - '0');
     }
     ungetc(ch);
-    return mkint(v);
+    return mkint(negative ? -v : v);
 }
 
 Value *lreadhex()
@@ -374,7 +782,9 @@ Value *lreadlist()
         return LISP_NIL;
     }
     car = lread();
+    PUSH_ROOT(car);
     cdr = lreadlist();
+    POP_ROOTS(1);
     return mkpair(car, cdr);
 }
 
@@ -385,14 +795,20 @@ Value *lread()
     ch = getchar();
     if (isspace(ch)) goto again;
 
+    // A sign is a symbol character too, so only a sign with a digit straight
+    // after it starts a number: -3 reads as a fixnum, (- 3) as a call.
+    if ((ch == '-' || ch == '+') && isdigit(peekchar())) return lreadint(ch == '-');
+    if (issymbol(ch)) return lreadsym(ch);
+
     ungetc(ch);
-    if (isalpha(ch)) return lreadsym();
-    else if (isdigit(ch)) return lreadint();
+    if (isdigit(ch)) return lreadint(0);
     else if (ch == '$') return lreadhex();
     else if (ch == '(') { getchar(); return lreadlist(); }
     else if (ch == '\'')  {
+        Value *quoted;
         getchar();
-        return mkpair(quote_sym, mkpair(lread(), LISP_NIL));
+        quoted = mkpair(lread(), LISP_NIL);
+        return mkpair(quote_sym, quoted);
     } else {
         getchar();
         error("Unrecognized token.");
@@ -401,27 +817,18 @@ Value *lread()
 
 void puthex(int v)
 {
-    char buf[8]; // max 32-bit int is 8 hex digits
-    int i = 0;
-    do {
-        int d = v & 0xf;
-        if (d < 10) {
-            buf[i++] = '0' + d;
-        } else {
-            buf[i++] = 'A' + d - 10;
-        }
-        v >>= 4;
-    } while (v != 0);
+    char buf[9];
 
-    cout('$' | 0x80);
-    while (i > 0) {
-        cout(buf[--i] | 0x80);
-    }
+    fmthex(buf, v, 0);
+    putchar('$');
+    puts(buf);
 }
 
 void lwriteint(Value *ptr)
 {
-    if (ptr->flags & F_HEX) {
+    if (LISP_FIXNUMP(ptr)) {
+        putint(FIXNUM_VALUE(ptr));
+    } else if (ptr->flags & F_HEX) {
         puthex(ptr->int_);
     } else {
         putint(ptr->int_);
@@ -430,7 +837,7 @@ void lwriteint(Value *ptr)
 
 void lwritesym(Value *ptr)
 {
-    puts(ptr->sym);
+    puts(ptr->sym.name);
 }
 
 void lwritenative(Value *ptr)
@@ -479,159 +886,526 @@ void lwrite(Value *ptr)
     }
 }
 
-Value *eval(Value *, Value *);
-Value *mapeval(Value *list, Value *env)
+// Forms read at the top level are compiled to bytecode for a stack VM. Each
+// lambda, and each top-level form, becomes a T_CODE object holding its
+// constants and its bytecode. References to lambda arguments compile to
+// OP_LOCAL, which indexes straight into a call frame. Every other symbol
+// refers to the global value stored in the symbol itself.
+enum opcode {
+    OP_NIL,       //                 push NIL
+    OP_CONST,     // k               push consts[k]
+    OP_LOCAL,     // depth, index    push a lambda argument
+    OP_GLOBAL,    // k               push the global value of symbol consts[k]
+    OP_DEFINE,    // k               set consts[k]'s global value to the top
+                  //                 of the stack, and replace it with consts[k]
+    OP_CLOSURE,   // k               push a closure of consts[k] over the frame
+    OP_CALL,      // n               call the procedure below the top n values
+    OP_TAILCALL,  // n               the same, replacing the current call
+    OP_JUMPNIL,   // lo, hi          pop, and jump if it was NIL
+    OP_JUMP,      // lo, hi          jump
+    OP_RETURN,    //                 return the top of the stack
+};
+
+// A reference to a lambda argument: the number of frames to walk up, and the
+// argument's slot in that frame.
+#define MKLOCAL(d, i)   ((Value*)(((uintptr_t)(d) << 10) | ((uintptr_t)(i) << 2) | 3))
+#define LOCAL_DEPTH(v)  ((uintptr_t)(v) >> 10)
+#define LOCAL_INDEX(v)  (((uintptr_t)(v) >> 2) & 0xff)
+
+// The state of one code object being compiled: where its bytes and
+// constants start in the scratch space, and its VM stack use so far.
+typedef struct fn {
+    int bytes;
+    int consts;
+    int depth;
+    int maxdepth;
+} Fn;
+
+void emit(uint8_t b)
 {
-    if (list == LISP_NIL)
-        return LISP_NIL;
-    return mkpair(eval(CAR(list), env), mapeval(CDR(list), env));
+    if (nbytes == COMPILE_BYTES) {
+        error("Form too big.");
+    }
+    cbytes[nbytes++] = b;
 }
 
-Value *bind(Value *name, Value *value, Value *env)
+void grow(Fn *fn, int n)
 {
-    Value *binding = mkpair(name, value);
-    return mkpair(binding, env);
+    fn->depth += n;
+    if (fn->depth > fn->maxdepth) {
+        fn->maxdepth = fn->depth;
+    }
 }
 
-Value *lookup(Value *name, Value *env)
+// Returns the index of v in fn's constants, adding it if necessary.
+uint8_t addconst(Fn *fn, Value *v)
 {
-    for (; !LISP_NILP(env); env = CDR(env)) {
-        // Pointer comparison is OK for interned symbols.
-        Value *binding = CAR(env);
-        if (CAR(binding) == name)
-            return CDR(binding);
+    int i;
+
+    for (i = fn->consts; i < nconsts; i++) {
+        if (cconsts[i] == v) {
+            return i - fn->consts;
+        }
     }
-    return NULL;
+    if (nconsts == COMPILE_CONSTS || nconsts - fn->consts == 256) {
+        error("Form too big.");
+    }
+    cconsts[nconsts++] = v;
+    return i - fn->consts;
 }
 
-Value *apply(Value *proc, Value *args)
+// Patches the jump whose operand is at offset at to land at the next byte.
+void patch(Fn *fn, int at)
 {
-    switch (gettype(proc)) {
-    case T_NATIVE:
-        return proc->fn(args);
-    case T_LAMBDA:
-        {
-            Value *call_env = proc->lambda.env;
-            Value *formal = proc->lambda.args;
-            Value *actual = args;
-            while (!LISP_NILP(formal) && !LISP_NILP(actual)) {
-                call_env = bind(CAR(formal), CAR(actual), call_env);
-                formal = CDR(formal);
-                actual = CDR(actual);
-            }
+    int to = nbytes - fn->bytes;
+    cbytes[at] = to & 0xff;
+    cbytes[at + 1] = to >> 8;
+}
 
-            // Argument count mismatch?
-            if (formal != actual) {
-                error("Argument count mismatch.\r");
+// Returns the reference to sym in scope, the list of the enclosing lambdas'
+// argument lists, innermost first.
+Value *resolve(Value *sym, Value *scope)
+{
+    int depth, index;
+    Value *formal;
+
+    for (depth = 0; !LISP_NILP(scope); depth++, scope = CDR(scope)) {
+        index = 0;
+        for (formal = CAR(scope); !LISP_NILP(formal); formal = CDR(formal)) {
+            if (CAR(formal) == sym) {
+                return MKLOCAL(depth, index);
             }
+            index++;
+        }
+    }
+    return sym;
+}
+
+Value *compile(Value *, Value *, int);
 
-            return eval(proc->lambda.body, call_env);
+// Emits code that pushes the value of form. A call in tail position replaces
+// the current call instead of returning to it.
+void compile_expr(Fn *fn, Value *form, Value *scope, int tail)
+{
+    Value *verb;
+    int at, n;
+
+    if (LISP_NILP(form)) {
+        emit(OP_NIL);
+        grow(fn, 1);
+        return;
+    }
+    switch (gettype(form)) {
+    case T_SYM:
+        {
+            Value *ref = resolve(form, scope);
+            if (ref != form) {
+                emit(OP_LOCAL);
+                emit(LOCAL_DEPTH(ref));
+                emit(LOCAL_INDEX(ref));
+            } else {
+                emit(OP_GLOBAL);
+                emit(addconst(fn, form));
+            }
+            grow(fn, 1);
         } break;
+    case T_PAIR:
+        PUSH_ROOT(form);
+        PUSH_ROOT(scope);
+        verb = CAR(form);
+        if (verb == quote_sym) {
+            emit(OP_CONST);
+            emit(addconst(fn, CADR(form)));
+            grow(fn, 1);
+        } else if (verb == if_sym) {
+            compile_expr(fn, CADR(form), scope, 0);
+            emit(OP_JUMPNIL);
+            at = nbytes;
+            emit(0);
+            emit(0);
+            fn->depth--;
+            compile_expr(fn, CADDR(form), scope, tail);
+            emit(OP_JUMP);
+            n = nbytes;
+            emit(0);
+            emit(0);
+            patch(fn, at);
+            fn->depth--;
+            compile_expr(fn, LISP_NILP(CDDDR(form)) ? LISP_NIL : CAR(CDDDR(form)), scope, tail);
+            patch(fn, n);
+        } else if (verb == lambda_sym) {
+            scope = mkpair(CADR(form), scope);
+            emit(OP_CLOSURE);
+            emit(addconst(fn, compile(CADDR(form), scope, 1)));
+            grow(fn, 1);
+        } else if (verb == define_sym) {
+            compile_expr(fn, CADDR(form), scope, 0);
+            emit(OP_DEFINE);
+            emit(addconst(fn, CADR(form)));
+        } else {
+            Value *arg;
+            compile_expr(fn, verb, scope, 0);
+            n = 0;
+            for (arg = CDR(form); !LISP_NILP(arg); arg = CDR(arg)) {
+                if (n == 255) {
+                    error("Too many arguments.");
+                }
+                PUSH_ROOT(arg);
+                compile_expr(fn, CAR(arg), scope, 0);
+                POP_ROOTS(1);
+                n++;
+            }
+            emit(tail ? OP_TAILCALL : OP_CALL);
+            emit(n);
+            fn->depth -= n;
+        }
+        POP_ROOTS(2);
+        break;
     default:
-        error("Type is not callable.");
+        emit(OP_CONST);
+        emit(addconst(fn, form));
+        grow(fn, 1);
+        break;
     }
 }
 
-void defglobal(Value *, Value *);
-Value *eval_define(Value *form, Value *env)
+// Compiles body into a code object. If body is a lambda's, scope starts with
+// its argument list; a top-level form has lambda set to 0.
+Value *compile(Value *body, Value *scope, int lambda)
 {
-    Value *name = CADR(form);
-    Value *value = eval(CADDR(form), env);
-    defglobal(name, value);
-    return name;
-}
+    Fn fn;
+    Value *p, *code;
+    size_t nalloc;
+    int nargs = 0, i;
+
+    if (lambda) {
+        for (p = CAR(scope); !LISP_NILP(p); p = CDR(p)) {
+            nargs++;
+        }
+    }
+    fn.bytes = nbytes;
+    fn.consts = nconsts;
+    fn.depth = 0;
+    fn.maxdepth = 0;
+    compile_expr(&fn, body, scope, 1);
+    emit(OP_RETURN);
+    if (fn.maxdepth > 255) {
+        error("Form too big.");
+    }
 
-Value *eval_lambda(Value *form, Value *env)
-{
-    Value *lambda_args = CADR(form);
-    Value *lambda_body = CADDR(form);
-    return mklambda(lambda_args, lambda_body, env);
+    nalloc = CODE_SIZE(nconsts - fn.consts, nbytes - fn.bytes);
+    maybe_gc(nalloc);
+    code = (Value *) heap;
+    code->type = T_CODE;
+    code->flags = 0;
+    code->code.nargs = nargs;
+    code->code.maxstack = fn.maxdepth;
+    code->code.nconsts = nconsts - fn.consts;
+    code->code.nbytes = nbytes - fn.bytes;
+    for (i = 0; i < code->code.nconsts; i++) {
+        code->code.consts[i] = cconsts[fn.consts + i];
+    }
+    for (i = 0; i < code->code.nbytes; i++) {
+        CODE_BYTES(code)[i] = cbytes[fn.bytes + i];
+    }
+    heap += nalloc;
+    nallocs++;
+
+    nbytes = fn.bytes;
+    nconsts = fn.consts;
+    return code;
 }
 
-Value *eval_if(Value *form, Value *env)
+// Makes sure the VM stack has room for code to run.
+void enter(Value *code)
 {
-    if (!LISP_NILP(eval(CADR(form), env))) {
-        return eval(CADDR(form), env);
-    } else {
-        return eval(CAR(CDDDR(form)), env);
+    if (sp + code->code.maxstack > VM_STACK_SIZE) {
+        error("Too deep.");
     }
 }
 
-Value *eval(Value *form, Value *env)
+// Runs code with env as its innermost frame, and returns its value. A call
+// from a native back into the VM, such as EVAL, nests another run on top of
+// the same stacks.
+Value *run(Value *code, Value *env)
 {
-    switch (gettype(form)) {
-    case T_INT: return form;
-    case T_SYM:
-        {
-            Value *value = lookup(form, env);
-            if (value == NULL) {
+    const int base = ncalls;
+    uint8_t *ip;
+    Value *proc, *result;
+    int n, pc, i;
+
+    PUSH_ROOT(code);
+    PUSH_ROOT(env);
+    enter(code);
+    ip = CODE_BYTES(code);
+    for (;;) {
+        uint8_t op = *ip++;
+        switch (op) {
+        case OP_NIL:
+            stack[sp++] = LISP_NIL;
+            break;
+        case OP_CONST:
+            stack[sp++] = code->code.consts[*ip++];
+            break;
+        case OP_LOCAL:
+            {
+                Value *frame = env;
+                for (n = *ip++; n > 0; n--) {
+                    frame = frame->frame.parent;
+                }
+                stack[sp++] = frame->frame.slots[*ip++];
+            } break;
+        case OP_GLOBAL:
+            result = code->code.consts[*ip++]->sym.value;
+            if (result == NULL) {
                 error("Undefined symbol.");
             }
-            return value;
-        } break;
-    case T_PAIR:
-        {
-            Value *verb = CAR(form);
-
-            if (verb == quote_sym) {
-                return CADR(form);
-            } else if (verb == lambda_sym) {
-                return eval_lambda(form, env);
-            } else if (verb == if_sym) {
-                return eval_if(form, env);
-            } else if (verb == define_sym) {
-                return eval_define(form, env);
-            } else {
-                return apply(eval(verb, env), mapeval(CDR(form), env));
+            stack[sp++] = result;
+            break;
+        case OP_DEFINE:
+            proc = code->code.consts[*ip++];
+            proc->sym.value = stack[sp - 1];
+            stack[sp - 1] = proc;
+            break;
+        case OP_CLOSURE:
+            pc = ip + 1 - CODE_BYTES(code);
+            result = mklambda(code->code.consts[*ip], env);
+            stack[sp++] = result;
+            ip = CODE_BYTES(code) + pc;
+            break;
+        case OP_JUMPNIL:
+            if (!LISP_NILP(stack[--sp])) {
+                ip += 2;
+                break;
             }
-        } break;
-    default:
-        error("I don't know how to evaluate that.");
-        break;
+            // fall through
+        case OP_JUMP:
+            ip = CODE_BYTES(code) + (ip[0] | ip[1] << 8);
+            break;
+        case OP_CALL:
+        case OP_TAILCALL:
+            n = *ip++;
+            pc = ip - CODE_BYTES(code);
+            proc = stack[sp - n - 1];
+            switch (gettype(proc)) {
+            case T_NATIVE:
+                result = proc->fn(&stack[sp - n], n);
+                sp -= n + 1;
+                if (op == OP_TAILCALL) {
+                    goto ret;
+                }
+                stack[sp++] = result;
+                ip = CODE_BYTES(code) + pc;
+                break;
+            case T_LAMBDA:
+                if (n != proc->lambda.code->code.nargs) {
+                    error("Argument count mismatch.\r");
+                }
+                if (op == OP_CALL) {
+                    if (ncalls == CALL_STACK_SIZE) {
+                        error("Too deep.");
+                    }
+                    calls[ncalls].code = code;
+                    calls[ncalls].env = env;
+                    calls[ncalls].pc = pc;
+                    ncalls++;
+                }
+                env = mkframe(n, proc->lambda.env);
+                proc = stack[sp - n - 1];
+                for (i = 0; i < n; i++) {
+                    env->frame.slots[i] = stack[sp - n + i];
+                }
+                sp -= n + 1;
+                code = proc->lambda.code;
+                enter(code);
+                ip = CODE_BYTES(code);
+                break;
+            default:
+                error("Type is not callable.");
+            }
+            break;
+        case OP_RETURN:
+            result = stack[--sp];
+        ret:
+            if (ncalls == base) {
+                POP_ROOTS(2);
+                return result;
+            }
+            ncalls--;
+            code = calls[ncalls].code;
+            env = calls[ncalls].env;
+            ip = CODE_BYTES(code) + calls[ncalls].pc;
+            stack[sp++] = result;
+            break;
+        }
     }
 }
 
 void defglobal(Value *name, Value *value)
 {
-    global_env->pair.cdr = bind(name, value, global_env->pair.cdr);    
+    name->sym.value = value;
 }
 
-void defnative(Value *name, Value* (*fn)(Value *))
+void defnative(Value *name, Value* (*fn)(Value **, int))
 {
-    defglobal(name, mknative(fn));
+    Value *native;
+
+    PUSH_ROOT(name);
+    native = mknative(fn);
+    POP_ROOTS(1);
+    defglobal(name, native);
 }
 
 // List manipulation.
-Value *native_cons(Value *args) { return mkpair(CAR(args), CADR(args)); }
-Value *native_car(Value *args)  { return CAAR(args); }
-Value *native_cdr(Value *args)  { return CDAR(args); }
-
-// Arithmetic.
-#define ARITH(op) mkint(CAR(args)->int_ op CADR(args)->int_)
-Value *native_plus(Value *args)  { return ARITH(+); }
-Value *native_minus(Value *args) { return ARITH(-); }
-Value *native_mul(Value *args)   { return ARITH(*); }
-Value *native_div(Value *args)   { return ARITH(/); }
+Value *native_cons(Value **args, int nargs) { return mkpair(args[0], args[1]); }
+Value *native_car(Value **args, int nargs)  { return CAR(args[0]); }
+Value *native_cdr(Value **args, int nargs)  { return CDR(args[0]); }
+
+Value *native_list(Value **args, int nargs)
+{
+    Value *list = LISP_NIL;
+
+    reserve_pairs(nargs);
+    while (nargs > 0) {
+        nargs--;
+        list = mkpair(args[nargs], list);
+    }
+    return list;
+}
+
+int length(Value *list)
+{
+    int n = 0;
+
+    for (; PAIRP(list); list = CDR(list)) {
+        n++;
+    }
+    return n;
+}
+
+Value *native_length(Value **args, int nargs) { return mkint(length(args[0])); }
+
+Value *native_nth(Value **args, int nargs)
+{
+    int n = INTVAL(args[0]);
+    Value *list = args[1];
+
+    for (; n > 0 && PAIRP(list); n--) {
+        list = CDR(list);
+    }
+    return PAIRP(list) ? CAR(list) : LISP_NIL;
+}
+
+// Copies every list but the last, which the result shares.
+Value *native_append(Value **args, int nargs)
+{
+    Value *list, *p, **tail;
+    int i, n = 0;
+
+    if (nargs == 0) {
+        return LISP_NIL;
+    }
+    for (i = 0; i < nargs - 1; i++) {
+        n += length(args[i]);
+    }
+    reserve_pairs(n);
+    tail = &list;
+    for (i = 0; i < nargs - 1; i++) {
+        for (p = args[i]; PAIRP(p); p = CDR(p)) {
+            *tail = mkpair(CAR(p), LISP_NIL);
+            tail = &CDR(*tail);
+        }
+    }
+    *tail = args[nargs - 1];
+    return list;
+}
+
+// Arithmetic. Each folds its arguments left to right. MINUS and DIV with one
+// argument negate and take the reciprocal, as in other Lisps.
+#define ARITH(name, op, identity)                         \
+    Value *name(Value **args, int nargs)                  \
+    {                                                     \
+        int i, v = identity;                              \
+        if (nargs > 0) {                                  \
+            v = INTVAL(args[0]);                          \
+        }                                                 \
+        for (i = 1; i < nargs; i++) {                     \
+            v = v op INTVAL(args[i]);                     \
+        }                                                 \
+        return mkint(v);                                  \
+    }
+ARITH(native_plus, +, 0)
+ARITH(native_mul, *, 1)
 #undef ARITH
 
+#define INVERSE(name, op, identity)                       \
+    Value *name(Value **args, int nargs)                  \
+    {                                                     \
+        int i, v;                                         \
+        if (nargs == 0) {                                 \
+            error("Too few arguments.");                  \
+        }                                                 \
+        if (nargs == 1) {                                 \
+            return mkint(identity op INTVAL(args[0]));    \
+        }                                                 \
+        v = INTVAL(args[0]);                              \
+        for (i = 1; i < nargs; i++) {                     \
+            v = v op INTVAL(args[i]);                     \
+        }                                                 \
+        return mkint(v);                                  \
+    }
+INVERSE(native_minus, -, 0)
+INVERSE(native_div, /, 1)
+#undef INVERSE
+
+// Comparison. The ordered comparisons hold if each argument is in that order
+// with the next; EQ compares identity, so it suits symbols and fixnums.
+#define BOOL(c) ((c) ? t_sym : LISP_NIL)
+#define COMPARE(name, op)                                 \
+    Value *name(Value **args, int nargs)                  \
+    {                                                     \
+        int i;                                            \
+        for (i = 1; i < nargs; i++) {                     \
+            if (!(INTVAL(args[i - 1]) op INTVAL(args[i]))) { \
+                return LISP_NIL;                          \
+            }                                             \
+        }                                                 \
+        return t_sym;                                     \
+    }
+COMPARE(native_lessp, <)
+COMPARE(native_le, <=)
+COMPARE(native_gt, >)
+COMPARE(native_ge, >=)
+COMPARE(native_numeq, ==)
+#undef COMPARE
+Value *native_eq(Value **args, int nargs) { return BOOL(args[0] == args[1]); }
+#undef BOOL
+
 // Miscellaneous.
-Value *native_eval(Value *args) { return eval(CAR(args), global_env); }
+Value *native_eval(Value **args, int nargs) { return run(compile(args[0], LISP_NIL, 0), LISP_NIL); }
 
 // Memory + bit manipulation.
-#define LOGIC(op) mkint(CAR(args)->int_ op CADR(args)->int_)
-Value* native_or(Value *args) { return LOGIC(|); }
-Value* native_and(Value *args) { return LOGIC(&); }
-Value* native_xor(Value *args) { return LOGIC(^); }
+#define LOGIC(name, op, identity)                         \
+    Value *name(Value **args, int nargs)                  \
+    {                                                     \
+        int i, v = identity;                              \
+        for (i = 0; i < nargs; i++) {                     \
+            v = v op INTVAL(args[i]);                     \
+        }                                                 \
+        return mkint(v);                                  \
+    }
+LOGIC(native_or, |, 0)
+LOGIC(native_and, &, -1)
+LOGIC(native_xor, ^, 0)
 #undef LOGIC
-Value* native_hex(Value *args) { return mkhex(CAR(args)->int_); }
-Value* native_peek(Value *args)
+Value* native_hex(Value **args, int nargs) { return mkhex(INTVAL(args[0])); }
+Value* native_peek(Value **args, int nargs)
 {
-    uint32_t addr = (uint32_t)CAR(args)->int_;
+    uint32_t addr = (uint32_t)INTVAL(args[0]);
 
     int s = 4;
-    Value* cdr = CDR(args);
-    if (cdr != NULL) {
-        s = CAR(cdr)->int_;
+    if (nargs > 1) {
+        s = INTVAL(args[1]);
         if (s > 4) s = 4;
     }
 
@@ -643,18 +1417,17 @@ Value* native_peek(Value *args)
     return mkhex(v);
 }
 
-Value* native_poke(Value *args)
+Value* native_poke(Value **args, int nargs)
 {
-    uint32_t addr = (uint32_t)CAR(args)->int_;
+    uint32_t addr = (uint32_t)INTVAL(args[0]);
 
     int s = 4;
-    Value* cddr = CDDR(args);
-    if (cddr != NULL) {
-        s = CAR(cddr)->int_;
+    if (nargs > 2) {
+        s = INTVAL(args[2]);
         if (s > 4) s = 4;
     }
 
-    int v = CADR(args)->int_;
+    int v = INTVAL(args[1]);
     for (; s > 0; s--, addr++) {
         *((uint8_t*)addr) = v & 0xff;
         v >>= 8;
@@ -662,38 +1435,379 @@ Value* native_poke(Value *args)
     return LISP_NIL;
 }
 
-int main()
+// Bulk memory. The copies go a word at a time whenever the addresses allow,
+// and HEXDUMP prints straight from memory without building a list.
+
+// Copies n bytes from src to dst. The ranges may overlap. If both addresses
+// are equally misaligned, the bytes up to a word boundary go first.
+void copy_bytes(uint8_t *dst, const uint8_t *src, uint32_t n)
 {
-    Value *result;
+    int words = (((uintptr_t)dst ^ (uintptr_t)src) & 3) == 0;
 
-    init();
+    if (dst <= src || dst >= src + n) {
+        if (words) {
+            for (; n > 0 && ((uintptr_t)dst & 3) != 0; n--) {
+                *dst++ = *src++;
+            }
+            for (; n >= 4; n -= 4, dst += 4, src += 4) {
+                *(uint32_t *)dst = *(const uint32_t *)src;
+            }
+        }
+        for (; n > 0; n--) {
+            *dst++ = *src++;
+        }
+    } else {
+        dst += n;
+        src += n;
+        if (words) {
+            for (; n > 0 && ((uintptr_t)dst & 3) != 0; n--) {
+                *--dst = *--src;
+            }
+            for (; n >= 4; n -= 4) {
+                dst -= 4;
+                src -= 4;
+                *(uint32_t *)dst = *(const uint32_t *)src;
+            }
+        }
+        for (; n > 0; n--) {
+            *--dst = *--src;
+        }
+    }
+}
+
+// Sets n bytes at dst to b.
+void fill_bytes(uint8_t *dst, uint8_t b, uint32_t n)
+{
+    uint32_t w = b * 0x01010101u;
+
+    for (; n > 0 && ((uintptr_t)dst & 3) != 0; n--) {
+        *dst++ = b;
+    }
+    for (; n >= 4; n -= 4, dst += 4) {
+        *(uint32_t *)dst = w;
+    }
+    for (; n > 0; n--) {
+        *dst++ = b;
+    }
+}
+
+// (PEEKB addr n) returns the n bytes at addr as a list.
+Value* native_peekb(Value **args, int nargs)
+{
+    uint8_t *addr = (uint8_t *)INTVAL(args[0]);
+    int n = INTVAL(args[1]);
+    Value *list = LISP_NIL;
+
+    reserve_pairs(n);
+    while (n > 0) {
+        n--;
+        list = mkpair(MKFIXNUM(addr[n]), list);
+    }
+    return list;
+}
+
+// (POKEB addr list) stores the bytes in list from addr up.
+Value* native_pokeb(Value **args, int nargs)
+{
+    uint8_t *addr = (uint8_t *)INTVAL(args[0]);
+    Value *p;
+
+    for (p = args[1]; PAIRP(p); p = CDR(p)) {
+        *addr++ = INTVAL(CAR(p));
+    }
+    return LISP_NIL;
+}
+
+// (MEMCPY dst src n)
+Value* native_memcpy(Value **args, int nargs)
+{
+    copy_bytes((uint8_t *)INTVAL(args[0]), (uint8_t *)INTVAL(args[1]), INTVAL(args[2]));
+    return LISP_NIL;
+}
+
+// (FILL addr n byte)
+Value* native_fill(Value **args, int nargs)
+{
+    fill_bytes((uint8_t *)INTVAL(args[0]), INTVAL(args[2]), INTVAL(args[1]));
+    return LISP_NIL;
+}
+
+// (HEXDUMP addr n) prints n bytes from addr, 8 to a line with their ASCII.
+Value* native_hexdump(Value **args, int nargs)
+{
+    uint8_t *addr = (uint8_t *)INTVAL(args[0]);
+    uint8_t *end = addr + INTVAL(args[1]);
+    int i;
+
+    while (addr < end) {
+        printf("\r$%04X:", (uintptr_t)addr);
+        for (i = 0; i < 8; i++) {
+            if (addr + i < end) {
+                printf(" %02X", addr[i]);
+            } else {
+                puts("   ");
+            }
+        }
+        putchar(' ');
+        for (i = 0; i < 8 && addr + i < end; i++) {
+            char c = addr[i] & 0x7f;
+            putchar(c >= ' ' && c < 0x7f ? c : '.');
+        }
+        addr += 8;
+    }
+    return LISP_NIL;
+}
+
+Value *native_save(Value **args, int nargs);
+Value *native_load(Value **args, int nargs);
+
+// Prints the collection and allocation counts, for the benchmark driver.
+Value *native_stats(Value **args, int nargs)
+{
+    puts("\rGCS: ");
+    putint(ngcs);
+    puts("\rALLOCS: ");
+    putint(nallocs);
+    putchar('\r');
+    return LISP_NIL;
+}
+
+// The natives, bound to their names at startup. Heap images refer to natives
+// by their index here, so new ones go at the end.
+const struct native_def {
+    const char *name;
+    Value *(*fn)(Value **, int);
+} natives[] = {
     // List manipulation.
-    defnative(mksym("CONS"), native_cons);
-    defnative(mksym("CAR"), native_car);
-    defnative(mksym("CDR"), native_cdr);
+    { "CONS", native_cons },
+    { "CAR", native_car },
+    { "CDR", native_cdr },
 
     // Arithmetic.
-    defnative(mksym("PLUS"), native_plus);
-    defnative(mksym("MINUS"), native_minus);
-    defnative(mksym("MUL"), native_mul);
-    defnative(mksym("DIV"), native_div);
+    { "PLUS", native_plus },
+    { "MINUS", native_minus },
+    { "MUL", native_mul },
+    { "DIV", native_div },
 
     // Miscellaneous.
-    defnative(mksym("EVAL"), native_eval);
-    defglobal(mksym("NIL"), LISP_NIL);
+    { "EVAL", native_eval },
 
     // Memory + bit manipulation.
-    defnative(mksym("OR"), native_or);
-    defnative(mksym("AND"), native_and);
-    defnative(mksym("XOR"), native_xor);
-    defnative(mksym("HEX"), native_hex);
-    defnative(mksym("PEEK"), native_peek);
-    defnative(mksym("POKE"), native_poke);
+    { "OR", native_or },
+    { "AND", native_and },
+    { "XOR", native_xor },
+    { "HEX", native_hex },
+    { "PEEK", native_peek },
+    { "POKE", native_poke },
+
+    // Heap images.
+    { "SAVE", native_save },
+    { "LOAD", native_load },
+
+    // Comparison.
+    { "LESSP", native_lessp },
+    { "EQ", native_eq },
+
+    // Miscellaneous.
+    { "STATS", native_stats },
+
+    // List manipulation.
+    { "LIST", native_list },
+    { "LENGTH", native_length },
+    { "NTH", native_nth },
+    { "APPEND", native_append },
+
+    // Arithmetic and comparison under their usual names.
+    { "+", native_plus },
+    { "-", native_minus },
+    { "*", native_mul },
+    { "/", native_div },
+    { "<", native_lessp },
+    { "<=", native_le },
+    { ">", native_gt },
+    { ">=", native_ge },
+    { "=", native_numeq },
+
+    // Bulk memory.
+    { "PEEKB", native_peekb },
+    { "POKEB", native_pokeb },
+    { "MEMCPY", native_memcpy },
+    { "FILL", native_fill },
+    { "HEXDUMP", native_hexdump },
+};
+
+#define NATIVE_COUNT (sizeof(natives) / sizeof(natives[0]))
+
+void defnatives()
+{
+    size_t i;
+
+    for (i = 0; i < NATIVE_COUNT; i++) {
+        defnative(mksym(natives[i].name), natives[i].fn);
+    }
+    defglobal(mksym("NIL"), LISP_NIL);
+    defglobal(t_sym, t_sym);
+}
+
+// Heap images. SAVE collects, which leaves both spaces compacted, and writes
+// them to the simulator's block device along with the symbol table. LOAD reads
+// them back into place and relocates every pointer, so an image still loads
+// after the program is rebuilt and its spaces move.
+#define IMAGE_MAGIC 0x484c5331 // "HLS1"
+#define IMAGE_NATIVES 48
+
+typedef struct image {
+    uint32_t magic;
+    char *heap_mem; // where the spaces were when the image was saved
+    uint32_t heap_size;
+    Pair *pair_mem;
+    uint32_t npairs;
+    uint32_t nnatives;
+    Value *(*natives[IMAGE_NATIVES])(Value **, int);
+} Image;
+
+// SAVE records every native, so a native added past IMAGE_NATIVES needs a
+// bigger image table (and breaks the images saved before it).
+_Static_assert(NATIVE_COUNT <= IMAGE_NATIVES, "natives do not fit in an image");
+
+Image image;
+
+Value *native_save(Value **args, int nargs)
+{
+    size_t i;
+
+    gc(0, 0);
+    image.magic = IMAGE_MAGIC;
+    image.heap_mem = heap_mem;
+    image.heap_size = heap - heap_mem;
+    image.pair_mem = pair_mem;
+    image.npairs = pairs - pair_mem;
+    image.nnatives = NATIVE_COUNT;
+    for (i = 0; i < NATIVE_COUNT; i++) {
+        image.natives[i] = natives[i].fn;
+    }
+    if (blkopen(1) != 0 ||
+        blkwrite(&image, sizeof(image)) != 0 ||
+        blkwrite(syms, sizeof(syms)) != 0 ||
+        blkwrite(heap_mem, image.heap_size) != 0 ||
+        blkwrite(pair_mem, image.npairs * sizeof(Pair)) != 0) {
+        error("Save failed.");
+    }
+    return mkint(sizeof(image) + sizeof(syms) + image.heap_size + image.npairs * sizeof(Pair));
+}
+
+// Returns where v, a value from the image, is now.
+Value *relocate(Value *v)
+{
+    if (((uintptr_t)v & 3) != 0) {
+        return v;
+    }
+    if ((char *)v >= image.heap_mem && (char *)v < image.heap_mem + image.heap_size) {
+        return (Value *) (heap_mem + ((char *)v - image.heap_mem));
+    }
+    if ((Pair *)v >= image.pair_mem && (Pair *)v < image.pair_mem + image.npairs) {
+        return (Value *) (pair_mem + ((Pair *)v - image.pair_mem));
+    }
+    return v;
+}
+
+// Starts over with a fresh heap after a load has failed part way through.
+void reload_failed(const char *what)
+{
+    init();
+    defnatives();
+    error(what);
+}
+
+Value *native_load(Value **args, int nargs)
+{
+    char *p;
+    size_t size, i;
+
+    if (blkopen(0) != 0 || blkread(&image, sizeof(image)) != 0) {
+        error("Load failed.");
+    }
+    if (image.magic != IMAGE_MAGIC || image.heap_size > sizeof(heap_mem) ||
+        image.npairs > PAIR_SPACE_SIZE || image.nnatives > IMAGE_NATIVES) {
+        error("Not an image.");
+    }
+
+    // Past here the heap is overwritten, so a failure has to start over.
+    if (blkread(syms, sizeof(syms)) != 0 ||
+        blkread(heap_mem, image.heap_size) != 0 ||
+        blkread(pair_mem, image.npairs * sizeof(Pair)) != 0) {
+        reload_failed("Load failed.");
+    }
+    heap = heap_mem + image.heap_size;
+    pairs = pair_mem + image.npairs;
+
+    for (i = 0; i < SYMBOL_TABLE_SIZE; i++) {
+        syms[i] = relocate(syms[i]);
+    }
+    for (i = 0; i < image.npairs; i++) {
+        pair_mem[i].car = relocate(pair_mem[i].car);
+        pair_mem[i].cdr = relocate(pair_mem[i].cdr);
+    }
+    for (p = heap_mem; p < heap; p += size) {
+        Value *v = (Value *) p;
+        size = objsize(v);
+        switch (v->type) {
+        case T_SYM:
+            v->sym.value = relocate(v->sym.value);
+            v->sym.next = relocate(v->sym.next);
+            break;
+        case T_LAMBDA:
+            v->lambda.code = relocate(v->lambda.code);
+            v->lambda.env = relocate(v->lambda.env);
+            break;
+        case T_CODE:
+            for (i = 0; i < v->code.nconsts; i++) {
+                v->code.consts[i] = relocate(v->code.consts[i]);
+            }
+            break;
+        case T_FRAME:
+            v->frame.parent = relocate(v->frame.parent);
+            for (i = 0; i < v->frame.nslots; i++) {
+                v->frame.slots[i] = relocate(v->frame.slots[i]);
+            }
+            break;
+        case T_NATIVE:
+            for (i = 0; i < image.nnatives && image.natives[i] != v->fn; i++)
+                ;
+            if (i >= image.nnatives || i >= NATIVE_COUNT) {
+                reload_failed("Image does not match.");
+            }
+            v->fn = natives[i].fn;
+            break;
+        }
+    }
+
+    quote_sym = mksym("QUOTE");
+    lambda_sym = mksym("LAMBDA");
+    define_sym = mksym("DEFINE");
+    if_sym = mksym("IF");
+    t_sym = mksym("T");
+
+    // Whatever called LOAD is gone with the old heap.
+    putchar('\r');
+    toplevel();
+    return LISP_NIL;
+}
+
+int main()
+{
+    Value *result;
+
+    init();
+    defnatives();
 
     for (;;) {
+        Value *form;
+
         setjmp(toplevel_escape);
         puts("> ");
-        result = eval(lread(), global_env);
+        form = compile(lread(), LISP_NIL, 0);
+        result = run(form, LISP_NIL);
         putchar('\r');
         lwrite(result);
         putchar('\r');
@@ -0,0 +1,220 @@
+// riscv-disas-host runs riscv-disas's decoder on the build machine. It reads RISC-V ELF executables such as bin/hlisp
+// and disassembles their code at native speed, labelling functions and branch and call targets from the ELF symbol
+// table:
+//
+//     riscv-disas-host bin/hlisp bin/ulisp ...
+//
+// With -s it instead writes the program's symbol table in the compact form the on-target disassembler loads (see
+// riscv-disas.h), which the build keeps as bin/<program>.sym:
+//
+//     riscv-disas-host -s bin/hlisp >bin/hlisp.sym
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "riscv-disas.h"
+
+// The parts of the ELF32 format used here. Fields are read by offset so that the host's struct layout and byte order
+// don't matter.
+#define EHDR_SHOFF     0x20
+#define EHDR_SHENTSIZE 0x2e
+#define EHDR_SHNUM     0x30
+
+#define SHDR_TYPE   0x04
+#define SHDR_FLAGS  0x08
+#define SHDR_ADDR   0x0c
+#define SHDR_OFFSET 0x10
+#define SHDR_SIZE   0x14
+#define SHDR_LINK   0x18
+
+#define SHT_PROGBITS    1
+#define SHT_SYMTAB      2
+#define SHF_EXECINSTR   0x4
+
+#define SYM_SIZE  16
+#define SYM_NAME  0x00
+#define SYM_VALUE 0x04
+#define SYM_INFO  0x0c
+#define SYM_SHNDX 0x0e
+
+#define STT_NOTYPE 0
+#define STT_FUNC   2
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+} Image;
+
+static uint32_t get16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put32(uint32_t v, FILE *out)
+{
+    fputc(v & 0xff, out);
+    fputc((v >> 8) & 0xff, out);
+    fputc((v >> 16) & 0xff, out);
+    fputc(v >> 24, out);
+}
+
+static void fail(const char *path, const char *what)
+{
+    fprintf(stderr, "riscv-disas-host: %s: %s\n", path, what);
+    exit(1);
+}
+
+static Image load(const char *path)
+{
+    Image image;
+    FILE *f = fopen(path, "rb");
+
+    if (f == NULL) {
+        fail(path, "cannot open");
+    }
+    fseek(f, 0, SEEK_END);
+    image.size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    image.data = malloc(image.size);
+    if (image.data == NULL || fread(image.data, 1, image.size, f) != image.size) {
+        fail(path, "cannot read");
+    }
+    fclose(f);
+
+    if (image.size < 0x34 || memcmp(image.data, "\177ELF", 4) != 0 || image.data[4] != 1 || image.data[5] != 1) {
+        fail(path, "not a little-endian ELF32 file");
+    }
+    return image;
+}
+
+static const uint8_t *section(const Image *image, unsigned i)
+{
+    return image->data + get32(image->data + EHDR_SHOFF) + i * get16(image->data + EHDR_SHENTSIZE);
+}
+
+static int compare_symbols(const void *a, const void *b)
+{
+    const rv_symbol *x = a, *y = b;
+
+    if (x->addr != y->addr) {
+        return x->addr < y->addr ? -1 : 1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+// Collects the code symbols: functions and untyped labels that belong to a section, less the assembler's local
+// labels. Sorts them by address and keeps one name per address.
+static void load_symbols(const Image *image)
+{
+    unsigned nsections = get16(image->data + EHDR_SHNUM);
+    rv_symbol *symbols = NULL;
+    int n = 0;
+
+    for (unsigned i = 0; i < nsections; i++) {
+        const uint8_t *sh = section(image, i);
+        if (get32(sh + SHDR_TYPE) != SHT_SYMTAB) {
+            continue;
+        }
+        const uint8_t *syms = image->data + get32(sh + SHDR_OFFSET);
+        uint32_t nsyms = get32(sh + SHDR_SIZE) / SYM_SIZE;
+        const char *names = (const char *)image->data + get32(section(image, get32(sh + SHDR_LINK)) + SHDR_OFFSET);
+
+        symbols = realloc(symbols, (n + nsyms) * sizeof(rv_symbol));
+        for (uint32_t j = 0; j < nsyms; j++) {
+            const uint8_t *sym = syms + j * SYM_SIZE;
+            unsigned type = sym[SYM_INFO] & 0xf;
+            unsigned shndx = get16(sym + SYM_SHNDX);
+            const char *name = names + get32(sym + SYM_NAME);
+            if ((type != STT_NOTYPE && type != STT_FUNC) || shndx == 0 || shndx >= 0xff00 || name[0] == '\0' ||
+                name[0] == '$' || strncmp(name, ".L", 2) == 0) {
+                continue;
+            }
+            symbols[n].addr = get32(sym + SYM_VALUE);
+            symbols[n].name = name;
+            n++;
+        }
+    }
+
+    qsort(symbols, n, sizeof(rv_symbol), compare_symbols);
+    int kept = 0;
+    for (int i = 0; i < n; i++) {
+        if (kept == 0 || symbols[kept - 1].addr != symbols[i].addr) {
+            symbols[kept++] = symbols[i];
+        }
+    }
+    rv_symbols = symbols;
+    rv_nsymbols = kept;
+}
+
+static void write_symbols(FILE *out)
+{
+    uint32_t strsize = 0;
+
+    for (int i = 0; i < rv_nsymbols; i++) {
+        strsize += strlen(rv_symbols[i].name) + 1;
+    }
+    put32(RV_SYMTAB_MAGIC, out);
+    put32(rv_nsymbols, out);
+    put32(strsize, out);
+
+    uint32_t offset = 0;
+    for (int i = 0; i < rv_nsymbols; i++) {
+        put32(rv_symbols[i].addr, out);
+        put32(offset, out);
+        offset += strlen(rv_symbols[i].name) + 1;
+    }
+    for (int i = 0; i < rv_nsymbols; i++) {
+        fwrite(rv_symbols[i].name, 1, strlen(rv_symbols[i].name) + 1, out);
+    }
+}
+
+static void disassemble(const Image *image)
+{
+    unsigned nsections = get16(image->data + EHDR_SHNUM);
+
+    for (unsigned i = 0; i < nsections; i++) {
+        const uint8_t *sh = section(image, i);
+        if (get32(sh + SHDR_TYPE) != SHT_PROGBITS || (get32(sh + SHDR_FLAGS) & SHF_EXECINSTR) == 0) {
+            continue;
+        }
+        uint32_t addr = get32(sh + SHDR_ADDR);
+        const uint8_t *code = image->data + get32(sh + SHDR_OFFSET);
+        uint32_t size = get32(sh + SHDR_SIZE) & ~3u;
+        for (uint32_t off = 0; off < size; off += 4) {
+            disasm_inst(addr + off, get32(code + off));
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 3 && strcmp(argv[1], "-s") == 0) {
+        Image image = load(argv[2]);
+        load_symbols(&image);
+        write_symbols(stdout);
+        return 0;
+    }
+    if (argc < 2 || argv[1][0] == '-') {
+        fprintf(stderr, "usage: %s elf...\n       %s -s elf >symbols\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        Image image = load(argv[i]);
+        load_symbols(&image);
+        if (argc > 2) {
+            printf("%s%s:\n", i > 1 ? "\n" : "", argv[i]);
+        }
+        disassemble(&image);
+        free((void *)rv_symbols);
+        free(image.data);
+    }
+    return 0;
+}
@@ -25,51 +25,40 @@
 
 #include "riscv-disas.h"
 
-#define NULL 0
+/*
+ * Built with -DHOST, this file is the decoder for riscv-disas-host, which
+ * runs on the build machine on top of stdio. Otherwise it is the program
+ * itself, on top of libc/io.c.
+ */
+#ifdef HOST
 
-uint32_t syscall(uint32_t addr, uint32_t arg);
+#include <stdio.h>
 
-void cout(char c) {
-	const uint32_t couta = 0xfded;
-	syscall(couta, (uint32_t)c);
-}
+#define EOL '\n'
 
-char rdkey() {
-	const uint32_t rdkeya = 0xfd0c;
-	return (char)syscall(rdkeya, 0);
-}
+#else
+
+#define NULL 0
+#define EOL '\r'
 
-char getc() {
+void cout(char c);
+char rdkey();
+void puts(const char* s);
+void printf(const char* fmt, ...);
+int blkopen(int write);
+int blkread(void* buf, unsigned n);
+
+char getchar() {
 	char c = rdkey();
 	cout(c);
 	return c & 0x7f;
 }
 
-void putc(char c) {
+void putchar(char c) {
 	cout(c | 0x80);
 }
 
-void puts(const char* s) {
-	for (int i = 0; s[i] != '\0'; i++) {
-		putc(s[i]);
-	}
-}
-
-void putint(int n) {
-	char buf[10]; // max 32-bit int is 10 decimal digits
-	if (n < 0) {
-		putc('-');
-	}
-	int i = 0;
-	do {
-		int d = n % 10;
-		buf[i++] = '0' + (n % 10);
-		n = n / 10;
-	} while (n > 0);
-	while (i > 0) {
-		putc(buf[--i]);
-	}
-}
+#endif
 
 typedef struct {
     const char * const name;
@@ -147,109 +136,106 @@ const rv_opcode_data opcode_data[] = {
     { "xori", rv_codec_i, rv_fmt_rd_rs1_imm },
 };
 
+/* decode tables */
+
+/*
+ * The major opcode, inst[6:2], picks an entry in major_ops. An opcode with
+ * one instruction maps straight to its rv_op. The rest are marked with
+ * DECODE_ROW and name a row of minor_ops, indexed by inst[30] and funct3.
+ * inst[30] is the only funct7 bit RV32I uses (sub, sra, srai). Rows that
+ * ignore it repeat their first eight entries.
+ */
+
+#define DECODE_ROW 0x80
+
+enum {
+    rv_row_load,
+    rv_row_misc_mem,
+    rv_row_op_imm,
+    rv_row_store,
+    rv_row_op,
+    rv_row_branch,
+    rv_row_jalr,
+    rv_row_system,
+};
+
+static const uint8_t major_ops[32] = {
+    [0]  = DECODE_ROW | rv_row_load,
+    [3]  = DECODE_ROW | rv_row_misc_mem,
+    [4]  = DECODE_ROW | rv_row_op_imm,
+    [5]  = rv_op_auipc,
+    [8]  = DECODE_ROW | rv_row_store,
+    [12] = DECODE_ROW | rv_row_op,
+    [13] = rv_op_lui,
+    [24] = DECODE_ROW | rv_row_branch,
+    [25] = DECODE_ROW | rv_row_jalr,
+    [27] = rv_op_jal,
+    [28] = DECODE_ROW | rv_row_system,
+};
+
+#define ROW(f0, f1, f2, f3, f4, f5, f6, f7) { \
+    rv_op_##f0, rv_op_##f1, rv_op_##f2, rv_op_##f3, rv_op_##f4, rv_op_##f5, rv_op_##f6, rv_op_##f7, \
+    rv_op_##f0, rv_op_##f1, rv_op_##f2, rv_op_##f3, rv_op_##f4, rv_op_##f5, rv_op_##f6, rv_op_##f7 }
+
+static const uint8_t minor_ops[][16] = {
+    [rv_row_load] = ROW(lb, lh, lw, illegal, lbu, lhu, lwu, illegal),
+    [rv_row_misc_mem] = ROW(fence, fence_i, illegal, illegal, illegal, illegal, illegal, illegal),
+    [rv_row_op_imm] = {
+        rv_op_addi, rv_op_slli, rv_op_slti, rv_op_sltiu, rv_op_xori, rv_op_srli, rv_op_ori, rv_op_andi,
+        rv_op_addi, rv_op_illegal, rv_op_slti, rv_op_sltiu, rv_op_xori, rv_op_srai, rv_op_ori, rv_op_andi,
+    },
+    [rv_row_store] = ROW(sb, sh, sw, illegal, illegal, illegal, illegal, illegal),
+    [rv_row_op] = {
+        rv_op_add, rv_op_sll, rv_op_slt, rv_op_sltu, rv_op_xor, rv_op_srl, rv_op_or, rv_op_and,
+        rv_op_sub, rv_op_illegal, rv_op_illegal, rv_op_illegal, rv_op_illegal, rv_op_sra, rv_op_illegal, rv_op_illegal,
+    },
+    [rv_row_branch] = ROW(beq, bne, illegal, illegal, blt, bge, bltu, bgeu),
+    [rv_row_jalr] = ROW(jalr, illegal, illegal, illegal, illegal, illegal, illegal, illegal),
+    [rv_row_system] = ROW(ecall, illegal, illegal, illegal, illegal, illegal, illegal, illegal),
+};
+
+#undef ROW
+
 /* decode opcode */
 
 static rv_opcode decode_inst_opcode(rv_inst inst)
 {
-    rv_opcode op = rv_op_illegal;
-	if (((inst >> 0) & 0x3) != 3) {
-		return op;
-	}
+    rv_opcode op;
 
-	switch (((inst >> 2) & 0x1f)) {
-	case 0:
-		switch (((inst >> 12) & 0x7)) {
-		case 0: op = rv_op_lb; break;
-		case 1: op = rv_op_lh; break;
-		case 2: op = rv_op_lw; break;
-		case 4: op = rv_op_lbu; break;
-		case 5: op = rv_op_lhu; break;
-		case 6: op = rv_op_lwu; break;
-		}
-		break;
-	case 3:
-		switch (((inst >> 12) & 0x7)) {
-		case 0: op = rv_op_fence; break;
-		case 1: op = rv_op_fence_i; break;
-		}
-		break;
-	case 4:
-		switch (((inst >> 12) & 0x7)) {
-		case 0: op = rv_op_addi; break;
-		case 1:
-			switch (((inst >> 27) & 0x1f)) {
-			case 0: op = rv_op_slli; break;
-			}
-			break;
-		case 2: op = rv_op_slti; break;
-		case 3: op = rv_op_sltiu; break;
-		case 4: op = rv_op_xori; break;
-		case 5:
-			switch (((inst >> 27) & 0x1f)) {
-			case 0: op = rv_op_srli; break;
-			case 8: op = rv_op_srai; break;
-			}
-			break;
-		case 6: op = rv_op_ori; break;
-		case 7: op = rv_op_andi; break;
-		}
-		break;
-	case 5: op = rv_op_auipc; break;
-	case 8:
-		switch (((inst >> 12) & 0x7)) {
-		case 0: op = rv_op_sb; break;
-		case 1: op = rv_op_sh; break;
-		case 2: op = rv_op_sw; break;
-		}
-		break;
-	case 12:
-		switch (((inst >> 22) & 0b1111111000) | ((inst >> 12) & 0b0000000111)) {
-		case 0: op = rv_op_add; break;
-		case 1: op = rv_op_sll; break;
-		case 2: op = rv_op_slt; break;
-		case 3: op = rv_op_sltu; break;
-		case 4: op = rv_op_xor; break;
-		case 5: op = rv_op_srl; break;
-		case 6: op = rv_op_or; break;
-		case 7: op = rv_op_and; break;
-		case 256: op = rv_op_sub; break;
-		case 261: op = rv_op_sra; break;
-		}
-		break;
-	case 13: op = rv_op_lui; break;
-	case 24:
-		switch (((inst >> 12) & 0x7)) {
-		case 0: op = rv_op_beq; break;
-		case 1: op = rv_op_bne; break;
-		case 4: op = rv_op_blt; break;
-		case 5: op = rv_op_bge; break;
-		case 6: op = rv_op_bltu; break;
-		case 7: op = rv_op_bgeu; break;
-		}
-		break;
-	case 25:
-		switch (((inst >> 12) & 0x7)) {
-		case 0: op = rv_op_jalr; break;
-		}
-		break;
-	case 27: op = rv_op_jal; break;
-	case 28:
-		switch (((inst >> 12) & 0x7)) {
-		case 0:
-			switch (((inst >> 20) & 0xfe0) | ((inst >> 7) & 0x1f)) {
-			case 0:
-				switch (((inst >> 15) & 0x3ff)) {
-				case 0: op = rv_op_ecall; break;
-				case 32: op = rv_op_ebreak; break;
-				}
-				break;
-			}
-			break;
-		}
-		break;
-	}
+    if ((inst & 0x3) != 3) {
+        return rv_op_illegal;
+    }
+
+    op = major_ops[(inst >> 2) & 0x1f];
+    if (op & DECODE_ROW) {
+        op = minor_ops[op & ~DECODE_ROW][((inst >> 27) & 0x8) | ((inst >> 12) & 0x7)];
+    }
+
+    /* the funct7 bits other than inst[30] must be zero */
+    switch (opcode_data[op].codec) {
+    case rv_codec_r:
+        if (inst & 0xbe000000) {
+            return rv_op_illegal;
+        }
+        break;
+    case rv_codec_i_sh7:
+        if (inst & 0xb8000000) {
+            return rv_op_illegal;
+        }
+        break;
+    }
+
+    /* ecall and ebreak differ only in inst[20], and all their other fields are zero */
+    if (op == rv_op_ecall) {
+        if ((inst & ~0x00100000) != 0x73) {
+            return rv_op_illegal;
+        }
+        if (inst & 0x00100000) {
+            op = rv_op_ebreak;
+        }
+    }
 
-	return op;
+    return op;
 }
 
 /* operand extractors */
@@ -328,61 +314,73 @@ static void decode_inst_operands(rv_decode *dec)
     };
 }
 
-void puthex8(uint32_t n) {
-	static const char *hex = "0123456789abcdef";
+/* symbols */
 
-	char buf[8];
-	int i = 0;
-	for (; n != 0; n = n >> 4) {
-		buf[i++] = hex[n & 0xf];
-	}
-	for (int j = 8; j > i; j--) {
-		putc('0');
-	}
-	while (i > 0) {
-		putc(buf[--i]);
-	}
+const rv_symbol *rv_symbols;
+int rv_nsymbols;
+
+/* returns the last symbol at or below addr, or NULL */
+static const rv_symbol *find_symbol(uint32_t addr)
+{
+    int lo = 0, hi = rv_nsymbols;
+
+    while (lo < hi) {
+        int mid = (lo + hi) >> 1;
+        if (rv_symbols[mid].addr <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo > 0 ? &rv_symbols[lo - 1] : NULL;
+}
+
+static void print_target(uint32_t addr)
+{
+    const rv_symbol *sym = find_symbol(addr);
+
+    if (sym == NULL) {
+        return;
+    }
+    if (sym->addr == addr) {
+        printf(" <%s>", sym->name);
+    } else {
+        printf(" <%s+0x%x>", sym->name, addr - sym->addr);
+    }
 }
 
 static void print_inst(rv_decode *dec)
 {
     const char *fmt;
 
-	puthex8(dec->inst);
-	putc(' ');
-	puts(opcode_data[dec->op].name);
-	putc(' ');
+	printf("%04x %08x %s ", dec->pc, dec->inst, opcode_data[dec->op].name);
 
     fmt = opcode_data[dec->op].format;
     while (*fmt) {
         switch (*fmt) {
         case '0':
-			putc('x');
-			putint(dec->rd);
+			printf("x%d", dec->rd);
             break;
         case '1':
-			putc('x');
-			putint(dec->rs1);
+			printf("x%d", dec->rs1);
             break;
         case '2':
-			putc('x');
-			putint(dec->rs2);
+			printf("x%d", dec->rs2);
             break;
         case 'i':
-			putint(dec->imm);
+			printf("%d", dec->imm);
             break;
         case 'o':
-			putint(dec->imm);
-			puts(" # 0x");
-			puthex8(dec->pc + dec->imm);
+			printf("%d # 0x%08x", dec->imm, dec->pc + dec->imm);
+			print_target(dec->pc + dec->imm);
             break;
         default:
-			putc(*fmt);
+			putchar(*fmt);
             break;
         }
         fmt++;
     }
-	putc('\r');
+	putchar(EOL);
 }
 
 /* disassemble instruction */
@@ -390,6 +388,12 @@ static void print_inst(rv_decode *dec)
 void disasm_inst(uint32_t pc, rv_inst inst)
 {
     rv_decode dec = { 0 };
+    const rv_symbol *sym = find_symbol(pc);
+
+    if (sym != NULL && sym->addr == pc) {
+        printf("%s:", sym->name);
+        putchar(EOL);
+    }
     dec.pc = pc;
     dec.inst = inst;
     dec.op = decode_inst_opcode(inst);
@@ -397,9 +401,100 @@ void disasm_inst(uint32_t pc, rv_inst inst)
 	print_inst(&dec);
 }
 
+#ifndef HOST
+
+/*
+ * The symbol table is read from sim6502's block device, so it is only there
+ * when the simulator was started with -disk bin/<program>.sym. The names stay
+ * in the buffer, and the entries become rv_symbols in place: on the target
+ * both are an address and a 32-bit word.
+ */
+#define SYMBOL_SPACE 4096
+
+static uint32_t symbol_space[SYMBOL_SPACE / 4];
+
+static void load_symbols()
+{
+    rv_symtab_header header;
+    rv_symtab_entry *entries = (rv_symtab_entry *)symbol_space;
+    rv_symbol *symbols = (rv_symbol *)symbol_space;
+
+    rv_nsymbols = 0;
+    if (blkopen(0) != 0 || blkread(&header, sizeof(header)) != 0 || header.magic != RV_SYMTAB_MAGIC) {
+        puts("no symbol table\r");
+        return;
+    }
+    /* each part is bounded on its own first, so that a foreign header can't wrap the sum */
+    uint32_t size = header.count * sizeof(rv_symtab_entry) + header.strsize;
+    if (header.count > SYMBOL_SPACE / sizeof(rv_symtab_entry) || header.strsize > SYMBOL_SPACE ||
+        size > SYMBOL_SPACE) {
+        puts("symbol table too big\r");
+        return;
+    }
+    if (blkread(symbol_space, size) != 0) {
+        puts("symbol table too short\r");
+        return;
+    }
+
+    /* every name must start inside the names and end at a NUL before they do */
+    const char *names = (const char *)&entries[header.count];
+    if (header.count > 0 && (header.strsize == 0 || names[header.strsize - 1] != '\0')) {
+        puts("symbol table too short\r");
+        return;
+    }
+    for (uint32_t i = 0; i < header.count; i++) {
+        if (entries[i].name >= header.strsize) {
+            puts("symbol table too short\r");
+            return;
+        }
+        symbols[i].name = names + entries[i].name;
+    }
+    rv_symbols = symbols;
+    rv_nsymbols = header.count;
+    printf("%d symbols\r", rv_nsymbols);
+}
+
+/* parses exactly four hex digits at s into addr, and returns whether it could */
+static int parse_addr(const char *s, uint16_t *addr)
+{
+	uint16_t naddr = 0;
+
+	for (int i = 0; i < 4; i++) {
+		uint8_t d;
+
+		char c = s[i];
+		if (c >= 'A' && c <= 'F') {
+			d = c - 'A' + 10;
+		} else if (c >= 'a' && c <= 'f') {
+			d = c - 'a' + 10;
+		} else if (c >= '0' && c <= '9') {
+			d = c - '0';
+		} else {
+			return 0;
+		}
+
+		naddr = (naddr << 4) | d;
+	}
+
+	*addr = naddr;
+	return 1;
+}
+
+/*
+ * Commands:
+ *
+ *     XXXX        disassemble a page of 24 instructions from XXXX
+ *     XXXX.YYYY   disassemble everything from XXXX through YYYY
+ *     (empty)     disassemble the next page
+ *     S           load the symbol table
+ *     Q           quit
+ *
+ * S reads the table from sim6502's block device (-disk bin/<program>.sym),
+ * which real hardware doesn't have, so there addresses go unannotated.
+ */
 int main() {
 	char buf[33];
-	uint16_t addr;
+	uint16_t addr = 0;
 
 	for (;;) {
 	next:
@@ -411,7 +506,7 @@ int main() {
 				goto next;
 			}
 
-			char c = getc();
+			char c = getchar();
 			if (c == '\r') {
 				buf[i] = '\0';
 				break;
@@ -419,37 +514,45 @@ int main() {
 			buf[i] = c;
 		}
 
+		if (buf[0] == 'Q') {
+			return 0;
+		}
+		if (buf[0] == 'S' && buf[1] == '\0') {
+			load_symbols();
+			continue;
+		}
+
 		if (buf[0] != '\0') {
-			// parse an address
-			uint16_t naddr = 0;
-
-			int i = 0;
-			for (i = 0; i < 4; i++) {
-				uint8_t d;
-
-				char c = buf[i];
-				if (c == 'Q') {
-					return 0;
-				} else if (c >= 'A' && c <= 'F') {
-					d = c - 'A' + 10;
-				} else if (c >= 'a' && c <= 'f') {
-					d = c - 'a' + 10;
-				} else if (c >= '0' && c <= '9') {
-					d = c - '0';
-				} else {
-					puts("invalid address\r");
+			uint16_t start, end;
+
+			if (!parse_addr(buf, &start)) {
+				puts("invalid address\r");
+				goto next;
+			}
+
+			if (buf[4] == '.') {
+				if (!parse_addr(&buf[5], &end) || buf[9] != '\0' || end < start) {
+					puts("invalid range\r");
 					goto next;
 				}
 
-				naddr = (naddr << 4) | d;
+				// Stream the whole range without stopping for a new command.
+				for (addr = start; ; addr += 4) {
+					disasm_inst((uint32_t)addr, *(uint32_t*)(uint32_t)addr);
+					if ((uint16_t)(end - addr) < 4) {
+						break;
+					}
+				}
+				addr += 4;
+				continue;
 			}
 
-			if (buf[i] != '\0') {
+			if (buf[4] != '\0') {
 				puts("syntax error\r");
 				goto next;
 			}
 
-			addr = naddr;
+			addr = start;
 		}
 
 		for (int i = 0; i < 24; i++) {
@@ -461,3 +564,5 @@ int main() {
 		}
 	}
 }
+
+#endif
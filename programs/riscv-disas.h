@@ -142,8 +142,38 @@ typedef struct {
     uint8_t   rs2;
 } rv_decode;
 
+typedef struct {
+    uint32_t  addr;
+    const char *name;
+} rv_symbol;
+
+/*
+ * A symbol table file, as riscv-disas-host -s writes it for the target: the
+ * header, then count entries sorted by address, then strsize bytes of
+ * NUL-terminated names. All fields are little-endian.
+ */
+
+#define RV_SYMTAB_MAGIC 0x31535652 /* "RVS1" */
+
+typedef struct {
+    uint32_t  magic;
+    uint32_t  count;
+    uint32_t  strsize;
+} rv_symtab_header;
+
+typedef struct {
+    uint32_t  addr;
+    uint32_t  name; /* offset into the names */
+} rv_symtab_entry;
+
+/* globals */
+
+/* symbols for annotating addresses, sorted by address */
+extern const rv_symbol *rv_symbols;
+extern int rv_nsymbols;
+
 /* functions */
 
-//void disasm_inst(uint32_t pc, rv_inst inst);
+void disasm_inst(uint32_t pc, rv_inst inst);
 
 #endif
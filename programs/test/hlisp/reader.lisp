@@ -0,0 +1,11 @@
+(DEFINE CHECK (LAMBDA (GOT WANT) (IF (= GOT WANT) T (MISREAD GOT WANT))))
+(CHECK -3 (- 0 3))
+(CHECK +7 7)
+(CHECK -0 0)
+(CHECK (- 10 -3) 13)
+(CHECK (+ -4 5) 1)
+(CHECK (CAR '(-2 X)) (- 0 2))
+(CHECK (- 5 2) 3)
+(CHECK (LENGTH '(- 3)) 2)
+(CHECK (LENGTH '(-X +Y)) 2)
+(CHECK (IF (EQ (CAR '(-)) '-) 1 0) 1)
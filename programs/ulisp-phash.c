@@ -0,0 +1,86 @@
+// ulisp-phash is a host tool run at build time. It reads programs/ulisp.c on
+// stdin, collects the builtin names from its `const char stringN[] = "..."`
+// definitions, and searches for a seed under which hashname gives each name a
+// slot of its own in a power-of-two table. It writes that table to stdout as a
+// header, so the reader can resolve a builtin with one hash and one compare.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAXNAMES 256
+#define MAXSEED 0x1000000
+
+char names[MAXNAMES][32];
+int nnames;
+
+// Must match hashname in ulisp.c.
+uint32_t hashname(const char *s, uint32_t h)
+{
+    for (; *s != '\0'; s++) {
+        h = ((h << 5) + h) ^ (uint8_t) *s;
+    }
+    return h ^ (h >> 16);
+}
+
+// Fills slots for the given seed and table size, and returns 0 if two names
+// collide.
+int try(uint32_t seed, int size, int *slots)
+{
+    for (int i = 0; i < size; i++) {
+        slots[i] = -1;
+    }
+    for (int i = 0; i < nnames; i++) {
+        uint32_t h = hashname(names[i], seed) & (size - 1);
+        if (slots[h] != -1) {
+            return 0;
+        }
+        slots[h] = i;
+    }
+    return 1;
+}
+
+int main(void)
+{
+    char line[256];
+    int slots[MAXNAMES * 4];
+
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        int n;
+        char name[32];
+        if (sscanf(line, "const char string%d[] = \"%31[^\"]\";", &n, name) == 2) {
+            if (n != nnames || n == MAXNAMES) {
+                fprintf(stderr, "ulisp-phash: string%d out of order\n", n);
+                return 1;
+            }
+            strcpy(names[nnames++], name);
+        }
+    }
+
+    int size = 1;
+    while (size < nnames) {
+        size <<= 1;
+    }
+    for (; size <= MAXNAMES * 4; size <<= 1) {
+        for (uint32_t seed = 0; seed < MAXSEED; seed++) {
+            if (!try(seed, size, slots)) {
+                continue;
+            }
+            printf("// Generated by ulisp-phash from programs/ulisp.c. Do not edit.\n\n");
+            printf("#define BUILTIN_SEED %uu\n", seed);
+            printf("#define BUILTIN_SLOTS %d\n\n", size);
+            printf("const uint8_t BuiltinSlots[BUILTIN_SLOTS] = {\n");
+            for (int i = 0; i < size; i++) {
+                if (slots[i] == -1) {
+                    printf("  0xff,\n");
+                } else {
+                    printf("  %d, // %s\n", slots[i], names[slots[i]]);
+                }
+            }
+            printf("};\n");
+            return 0;
+        }
+    }
+    fprintf(stderr, "ulisp-phash: no perfect hash found\n");
+    return 1;
+}
@@ -5,6 +5,7 @@
 */
 
 #include <stdint.h>
+#include "ulisp-builtins.h"
 
 // C Macros
 
@@ -23,10 +24,13 @@
 
 #define symbolp(x)         ((x)->type == SYMBOL)
 
-#define mark(x)            (car(x) = (object *)(((uintptr_t)(car(x))) | MARKBIT))
-#define unmark(x)          (car(x) = (object *)(((uintptr_t)(car(x))) & ~MARKBIT))
-#define marked(x)          ((((uintptr_t)(car(x))) & MARKBIT) != 0)
-#define MARKBIT            1
+#define cellno(x)          ((object *)(x) - Workspace)
+#define mark(x)            (Marks[cellno(x)>>3] |= 1<<(cellno(x)&7))
+#define marked(x)          ((Marks[cellno(x)>>3] & 1<<(cellno(x)&7)) != 0)
+#define reverse(x)         (car(x) = (object *)(((uintptr_t)(car(x))) | CDRBIT))
+#define unreverse(x)       (car(x) = (object *)(((uintptr_t)(car(x))) & ~CDRBIT))
+#define reversed(x)        ((((uintptr_t)(car(x))) & CDRBIT) != 0)
+#define CDRBIT             1
 
 typedef struct {
 	uint32_t state[14];
@@ -37,11 +41,12 @@ extern "C" void longjmp(jmp_buf env, int val);
 
 // Constants
 
-enum type { ZERO=0, SYMBOL=2, PAIR=4 };  // PAIR must be last
+enum type { ZERO=0, LOCAL=1, SYMBOL=2, PAIR=4 };  // PAIR must be last
 enum token { UNUSED, BRA, KET, QUO, DOT };
 
-enum function { SYMBOLS, NIL, TEE, LAMBDA, SPECIAL_FORMS, QUOTE, DEFUN, DEFVAR, SETQ, IF, FUNCTIONS, NOT,
-NULLFN, CONS, ATOM, LISTP, CONSP, SYMBOLP, EQ, CAR, CDR, EVAL, GLOBALS, LOCALS, ENDFUNCTIONS };
+enum function { SYMBOLS, NIL, TEE, LAMBDA, CLOSURE, SPECIAL_FORMS, QUOTE, DEFUN, DEFVAR, SETQ, LOOP, RETURN,
+TAIL_FORMS, LET, IF, FUNCTIONS, NOT, NULLFN, CONS, ATOM, LISTP, CONSP, SYMBOLP, EQ, CAR, CDR, EVAL, GLOBALS, LOCALS,
+SAVE, LOAD, STATS, ENDFUNCTIONS };
 
 // Typedefs
 
@@ -58,38 +63,70 @@ typedef struct sobject {
       union {
         symbol_t name;
         int integer;
+        struct {                      // LOCAL: a resolved variable reference
+          uint16_t local;             // its symbol's name
+          uint8_t index;              // its slot in the frame
+          uint8_t depth;              // the number of frames out
+        };
       };
     };
   };
 } object;
 
 typedef object *(* const fn_ptr_type)(object *, object *);
+typedef object *(* const fn_args_type)(object **, object *);
 
+// Special and tail forms take their unevaluated arguments as a list in fptr.
+// Functions take their evaluated arguments in place on Args in fargs.
 typedef struct {
   char const * string;
   fn_ptr_type fptr;
+  fn_args_type fargs;
   int min;
   int max;
 } tbl_entry_t;
 
 // Workspace - sizes in bytes
-#define WORDALIGNED __attribute__((aligned (2)))
 #define BUFFERSIZE 18
-#define WORKSPACESIZE 1000            /* Cells (4*bytes) */
 
-object Workspace[WORKSPACESIZE] WORDALIGNED;
+// The workspace and its mark bitmap fill the RAM between the end of .bss and
+// the stack reserve, both set by the linker script. They are laid out at
+// startup by initworkspace.
+extern "C" uint8_t _end;
+extern "C" uint8_t _stack_limit;
+
+// Every level of eval recursion runs on the C stack, which the default 4K
+// reserve holds to a couple of dozen Lisp calls. STACKRESERVE buys a deeper
+// stack at the cost of workspace; the linker scripts read it as
+// _stack_reserve.
+#define STACKRESERVE "0x2000"
+asm(".globl _stack_reserve\n.set _stack_reserve, " STACKRESERVE);
+
+object *Workspace;
+unsigned int WorkspaceSize;           /* Cells */
+uint8_t *Marks;
 char Buffer[BUFFERSIZE];
 
 // Global variables
 
 jmp_buf exception;
 unsigned int Freespace = 0;
+unsigned int Sweep = 0;
 char ReturnFlag = 0;
-object *Freelist;
-//extern uint8_t _end;
+
+// Counts of collections and of cells allocated, reported by STATS
+unsigned int GCCount = 0;
+unsigned int AllocCount = 0;
 
 object *GlobalEnv;
 object *GCStack = NULL;
+
+// Evaluated function calls are built here rather than consed: the function,
+// then its arguments. Builtins read their arguments in place, and closures
+// bind from them.
+#define ARGSTACKSIZE 256
+object *Args[ARGSTACKSIZE];
+unsigned int Argp = 0;
 char LastChar = 0;
 char LastPrint = 0;
 volatile char Escape = 0;
@@ -109,35 +146,42 @@ void printobject(object *form);
 void pstring (char const * s);
 object *read();
 extern "C" uint32_t syscall(uint32_t addr, uint32_t arg);
+extern "C" int blkopen(int write);
+extern "C" int blkwrite(const void* buf, unsigned n);
+extern "C" int blkread(void* buf, unsigned n);
+extern "C" int fmtint(char* buf, int n);
+void initenv();
 
 // Set up workspace
 
+// There is no free list. Freespace counts the unmarked cells at or above
+// Sweep, and myalloc sweeps lazily up to the next one. A gc just marks, and
+// starts the sweep again from the bottom.
+
+void clearmarks () {
+  for (unsigned int i=0; i<(WorkspaceSize+7)/8; i++) Marks[i] = 0;
+}
+
 void initworkspace () {
-  Freelist = NULL;
-  for (int i=WORKSPACESIZE-1; i>=0; i--) {
-    object *obj = &Workspace[i];
-    car(obj) = NULL;
-    cdr(obj) = Freelist;
-    Freelist = obj;
-    Freespace++;
-  }
+  uintptr_t start = ((uintptr_t)&_end + 7) & ~(uintptr_t)7;
+  // Each cell takes sizeof(object) bytes, plus one bit of bitmap
+  WorkspaceSize = ((uintptr_t)&_stack_limit - start) * 8 / (8*sizeof(object) + 1);
+  Workspace = (object *)start;
+  Marks = (uint8_t *)&Workspace[WorkspaceSize];
+  clearmarks();
+  Sweep = 0;
+  Freespace = WorkspaceSize;
 }
 
 object *myalloc () {
   if (Freespace == 0) error("NO ROOM");
-  object *temp = Freelist;
-  Freelist = cdr(Freelist);
+  object *temp;
+  do temp = &Workspace[Sweep++]; while (marked(temp));
   Freespace--;
+  AllocCount++;
   return temp;
 }
 
-inline void myfree (object *obj) {
-  car(obj) = NULL;
-  cdr(obj) = Freelist;
-  Freelist = obj;
-  Freespace++;
-}
-
 // Make each type of object
 
 object *cons (object *arg1, object *arg2) {
@@ -156,47 +200,68 @@ object *symbol (symbol_t name) {
 
 // Garbage collection
 
-void markobject (object *obj) {
-  MARK:
-  if (obj == NULL) return;
-  if (marked(obj)) return;
-
-  object* arg = car(obj);
-  unsigned int type = obj->type;
-  mark(obj);
-  
-  if (type >= PAIR || type == ZERO) { // cons
-    markobject(arg);
-    obj = cdr(obj);
-    goto MARK;
-  }
-}
+// Deutsch-Schorr-Waite marking, which needs no stack. On the way down, the
+// car or cdr being followed is pointed back at the parent; CDRBIT in the car
+// says which. The way back up restores it.
 
-void sweep () {
-  Freelist = NULL;
-  Freespace = 0;
-  for (int i=WORKSPACESIZE-1; i>=0; i--) {
-    object *obj = &Workspace[i];
-    if (!marked(obj)) myfree(obj); else unmark(obj);
+void markobject (object *obj) {
+  object *prev = NULL;
+  for (;;) {
+    // Descend through cars
+    while (obj != NULL && !marked(obj)) {
+      mark(obj);
+      Freespace--;
+      unsigned int type = obj->type;
+      if (type < PAIR && type != ZERO) break; // symbol
+      object *next = car(obj);
+      car(obj) = prev;
+      prev = obj; obj = next;
+    }
+    // Back up until there is a cdr still to follow
+    for (;;) {
+      if (prev == NULL) return;
+      if (!reversed(prev)) {
+        object *next = cdr(prev);
+        cdr(prev) = car(prev);
+        car(prev) = obj; reverse(prev);
+        obj = next;
+        break;
+      }
+      object *back = cdr(prev);
+      unreverse(prev);
+      cdr(prev) = obj;
+      obj = prev; prev = back;
+    }
   }
 }
 
 void gc (object *form, object *env) {
+  GCCount++;
+  clearmarks();
+  Freespace = WorkspaceSize;
   markobject(tee); 
   markobject(GlobalEnv);
   markobject(GCStack);
   markobject(form);
   markobject(env);
-  sweep();
+  for (unsigned int i=0; i<Argp; i++) markobject(Args[i]);
+  Sweep = 0;
 }
 
 // Error handling
 
+// Abandons whatever is running and returns to the REPL
+void restart () {
+  GCStack = NULL;
+  Argp = 0;
+  ReturnFlag = 0;
+  longjmp(exception, 1);
+}
+
 void error (char const * string) {
   pfl(); pstring("ERROR: ");
   pstring(string); pln();
-  GCStack = NULL;
-  longjmp(exception, 1);
+  restart();
 }
 
 void error2 (object *symbol, char const * string) {
@@ -204,8 +269,18 @@ void error2 (object *symbol, char const * string) {
   if (symbol == NULL) pstring("FUNCTION ");
   else { pchar('\''); printobject(symbol); pstring("' "); }
   pstring(string); pln();
-  GCStack = NULL;
-  longjmp(exception, 1);
+  restart();
+}
+
+// The C stack runs down from STACK_TOP to _stack_limit, just above the mark
+// bitmap, and would run on into it unchecked. So eval, the reader and the
+// printer check before each level of recursion, leaving STACKMARGIN bytes for
+// the builtins and for error itself.
+
+#define STACKMARGIN 512
+
+inline void checkstack () {
+  if ((uintptr_t)__builtin_frame_address(0) < (uintptr_t)&_stack_limit + STACKMARGIN) error("STACK FULL");
 }
 
 // Helper functions
@@ -228,38 +303,66 @@ bool listp (object *x) {
   return type >= PAIR || type == ZERO;
 }
 
-int toradix40 (char ch) {
-  if (ch == 0) return 0;
-  if (ch >= '0' && ch <= '9') return ch-'0'+30;
-  if (ch >= 'A' && ch <= 'Z') return ch-'A'+1;
-  //if (ch >= 'a' && ch <= 'z') return ch-'a'+1;
-  return -1; // Invalid
-}
+// Symbol names
+
+// A symbol's name below ENDFUNCTIONS is a builtin. Any other name is
+// ENDFUNCTIONS plus the offset of its text in Names, where the reader interns
+// it through the open-addressed hash table Symtab.
+
+#define NAMESSIZE 1024
+#define SYMTABSIZE 128                /* Power of two */
+
+char Names[NAMESSIZE];
+unsigned int NamesUsed = 0;
+unsigned int Symbols = 0;
+uint16_t Symtab[SYMTABSIZE];          /* Offset in Names plus one, or zero */
 
-int fromradix40 (int n) {
-  if (n >= 1 && n <= 26) return 'A'+n-1;
-  if (n >= 30 && n <= 39) return '0'+n-30;
-  return 0;
+// ulisp-phash computes the builtin table with the same function.
+uint32_t hashname (char const *s, uint32_t h) {
+  for (; *s != '\0'; s++) h = ((h << 5) + h) ^ (uint8_t)*s;
+  return h ^ (h >> 16);
 }
 
-int pack40 (char *buffer) {
-  return (((toradix40(buffer[0]) * 40) + toradix40(buffer[1])) * 40 + toradix40(buffer[2]));
+bool streq (char const * a, char const * b) {
+	for (;;) {
+		if (*a != *b) {
+			return false;
+		}
+		if (*a == '\0') {
+			return true;
+		}
+		a++, b++;
+	}
 }
 
-bool valid40 (char *buffer) {
- return (toradix40(buffer[0]) >= 0 && toradix40(buffer[1]) >= 0 && toradix40(buffer[2]) >= 0);
+symbol_t intern (char const *n) {
+  unsigned int i = hashname(n, 5381) & (SYMTABSIZE-1);
+  for (;;) {
+    unsigned int offset = Symtab[i];
+    if (offset == 0) break;
+    if (streq(n, &Names[offset-1])) return ENDFUNCTIONS + offset-1;
+    i = (i+1) & (SYMTABSIZE-1);
+  }
+  unsigned int start = NamesUsed, length = 0;
+  while (n[length] != '\0') length++;
+  // Leave one slot empty so that a failed probe always ends
+  if (start + length + 1 > NAMESSIZE || Symbols == SYMTABSIZE-1) error("NO ROOM FOR SYMBOL");
+  for (unsigned int j=0; j<=length; j++) Names[start+j] = n[j];
+  NamesUsed = start + length + 1;
+  Symbols++;
+  Symtab[i] = start + 1;
+  return ENDFUNCTIONS + start;
 }
 
 char const * name (object *obj) {
-  if(!symbolp(obj)) error("ERROR IN NAME");
-  symbol_t x = obj->name;
-  if (x < ENDFUNCTIONS) return lookupbuiltin(x);
-  Buffer[3] = '\0';
-  for (int n=2; n>=0; n--) {
-    Buffer[n] = fromradix40(x % 40);
-    x = x / 40;
+  symbol_t x;
+  if (obj->type == LOCAL) x = obj->local;
+  else {
+    if(!symbolp(obj)) error("ERROR IN NAME");
+    x = obj->name;
   }
-  return Buffer;
+  if (x < ENDFUNCTIONS) return lookupbuiltin(x);
+  return &Names[x - ENDFUNCTIONS];
 }
 
 int issymbol (object *obj, symbol_t n) {
@@ -272,11 +375,14 @@ int eq (object *arg1, object *arg2) {
   return (same_object || same_symbol);
 }
 
+// Returns the last form for eval to evaluate in place. If a RETURN is
+// evaluated first, returns its value quoted, leaving ReturnFlag set for LOOP.
 object *progn (object *args, object *env) {
   if (args == NULL) return nil;
   object *more = cdr(args);
   while (more != NULL) {
-  eval(car(args), env);
+    object *result = eval(car(args), env);
+    if (ReturnFlag) return cons(symbol(QUOTE), cons(result, NULL));
     args = more;
     more = cdr(args);
   }
@@ -294,10 +400,8 @@ object *value (symbol_t n, object *env) {
   return nil;
 }
 
-object *findvalue (object *var, object *env) {
-  symbol_t varname = var->name;
-  object *pair = value(varname, env);
-  if (pair == NULL) pair = value(varname, GlobalEnv);
+object *findvalue (object *var) {
+  object *pair = value(var->name, GlobalEnv);
   if (pair == NULL) error2(var,"UNKNOWN VARIABLE");
   return pair;
 }
@@ -311,34 +415,117 @@ object *findtwin (object *var, object *env) {
   return NULL;
 }
 
-void dropframe (int tc, object **env) {
-  if (tc) {
-    while (*env != NULL && car(*env) != NULL) {
-      pop(*env);
+// Lexical environments
+
+// An environment is a chain of frames, one for each lambda call or LET that
+// encloses the code. A frame is a list whose car is the enclosing frame and
+// whose cdr holds the values of its variables in order. Before a top-level
+// form is evaluated, resolve replaces each reference to a variable with a
+// LOCAL that gives its frame and slot, so finding it needs no search.
+
+typedef struct scope {
+  object *names;
+  struct scope *parent;
+} scope;
+
+object *bindname (object *binding) {
+  return consp(binding) ? car(binding) : binding;
+}
+
+object *local (symbol_t name, int depth, int index) {
+  if (depth > 255 || index > 255) error("TOO MANY LOCALS");
+  object *ptr = myalloc();
+  ptr->type = LOCAL;
+  ptr->local = name;
+  ptr->index = index;
+  ptr->depth = depth;
+  return ptr;
+}
+
+object *resolve (object *form, scope *sc);
+
+void resolvelist (object *list, scope *sc) {
+  for (; consp(list); list = cdr(list)) car(list) = resolve(car(list), sc);
+}
+
+object *resolve (object *form, scope *sc) {
+  if (form == NULL) return form;
+  if (symbolp(form)) {
+    if (form->name < ENDFUNCTIONS) return form;
+    int depth = 0;
+    for (; sc != NULL; sc = sc->parent, depth++) {
+      int index = 0;
+      for (object *n = sc->names; n != NULL; n = cdr(n), index++) {
+        if (bindname(car(n))->name == form->name) return local(form->name, depth, index);
+      }
+    }
+    return form;
+  }
+  if (!consp(form)) return form;
+  object *head = car(form);
+  if (symbolp(head)) {
+    symbol_t name = head->name;
+    if (name == QUOTE || name == CLOSURE) return form;
+    if (name == LAMBDA || name == DEFUN) {
+      object *params = cdr(form);
+      if (name == DEFUN) params = cdr(params);
+      scope inner = { first(params), sc };
+      resolvelist(cdr(params), &inner);
+      return form;
+    }
+    if (name == DEFVAR) {
+      resolvelist(cddr(form), sc);
+      return form;
+    }
+    if (name == LET) {
+      for (object *b = second(form); consp(b); b = cdr(b)) {
+        if (consp(car(b))) resolvelist(cdr(car(b)), sc);
+      }
+      scope inner = { second(form), sc };
+      resolvelist(cddr(form), &inner);
+      return form;
     }
-  } else {
-    push(nil, *env);
   }
+  resolvelist(form, sc);
+  return form;
+}
+
+// Returns the cell whose car holds the value of a LOCAL
+object *slot (object *var, object *env) {
+  for (int d = var->depth; d > 0; d--) env = car(env);
+  object *slots = cdr(env);
+  for (int i = var->index; i > 0; i--) slots = cdr(slots);
+  return slots;
+}
+
+object *mkframe (object *parent, object **values, int n) {
+  object *slots = NULL;
+  while (n > 0) {
+    n--;
+    slots = cons(values[n], slots);
+  }
+  return cons(parent, slots);
 }
 
 // Handling closures
-  
-object *closure (object *fname, object *function, object *args, object **env) {
-  object *params = first(function);
-  function = cdr(function);
-  // Add arguments to environment
-  while (params != NULL && args != NULL) {
-    object *value;
-    object *var = first(params);
-    value = first(args);
-    args = cdr(args);
-    push(cons(var,value), *env);
-    params = cdr(params);
+
+// A function is (LAMBDA params . body) if it was made at the top level, or
+// (CLOSURE env params . body) if it captured an environment. Binds args in a
+// new frame and returns the body.
+object *closure (object *fname, object *function, object **args, int nargs, object **env) {
+  object *parent = NULL;
+  if (issymbol(car(function), CLOSURE)) {
+    function = cdr(function);
+    parent = car(function);
   }
-  if (params != NULL) error2(fname, "HAS TOO FEW PARAMETERS");
-  if (args != NULL) error2(fname, "HAS TOO MANY PARAMETERS");
-  // Do an implicit progn
-  return progn(function, *env);
+  function = cdr(function);
+  object *params = first(function);
+  int n = 0;
+  for (; params != NULL; params = cdr(params)) n++;
+  if (n > nargs) error2(fname, "HAS TOO FEW PARAMETERS");
+  if (n < nargs) error2(fname, "HAS TOO MANY PARAMETERS");
+  *env = mkframe(parent, args, nargs);
+  return cdr(function);
 }
 
 // Checked car and cdr
@@ -363,10 +550,9 @@ object *sp_quote (object *args, object *env) {
 }
 
 object *sp_defun (object *args, object *env) {
-  (void) env;
   object *var = first(args);
   if (!symbolp(var)) error2(var, "IS NOT A SYMBOL");
-  object *val = cons(symbol(LAMBDA), cdr(args));
+  object *val = (env == NULL) ? cons(symbol(LAMBDA), cdr(args)) : cons(symbol(CLOSURE), cons(env, cdr(args)));
   object *pair = value(var->name,GlobalEnv);
   if (pair != NULL) { cdr(pair) = val; return var; }
   push(cons(var, val), GlobalEnv);
@@ -385,81 +571,217 @@ object *sp_defvar (object *args, object *env) {
 
 object *sp_setq (object *args, object *env) {
   object *arg = eval(second(args), env);
-  object *pair = findvalue(first(args), env);
-  cdr(pair) = arg;
+  object *var = first(args);
+  if (var != NULL && var->type == LOCAL) car(slot(var, env)) = arg;
+  else cdr(findvalue(var)) = arg;
   return arg;
 }
 
-object *sp_if (object *args, object *env) {
-  if (eval(first(args), env) != nil) return eval(second(args), env);
-  return eval(third(args), env);
+object *sp_loop (object *args, object *env) {
+  object *start = args;
+  for (;;) {
+    args = start;
+    while (args != NULL) {
+      object *result = eval(car(args), env);
+      if (ReturnFlag) {
+        ReturnFlag = 0;
+        return result;
+      }
+      args = cdr(args);
+    }
+  }
+}
+
+object *sp_return (object *args, object *env) {
+  object *result = (args != NULL) ? eval(first(args), env) : nil;
+  ReturnFlag = 1;
+  return result;
+}
+
+// Tail-recursive forms
+// These return the form to evaluate next, which eval then evaluates in place
+// instead of recursing.
+
+object *tf_if (object *args, object *env) {
+  if (eval(first(args), env) != nil) return second(args);
+  args = cddr(args);
+  return (args != NULL) ? first(args) : nil;
 }
 
 // Core functions
 
-object *fn_not (object *args, object *env) {
+object *fn_not (object **args, object *env) {
   (void) env;
-  return (first(args) == nil) ? tee : nil;
+  return (args[0] == nil) ? tee : nil;
 }
 
-object *fn_cons (object *args, object *env) {
+object *fn_cons (object **args, object *env) {
   (void) env;
-  return cons(first(args),second(args));
+  return cons(args[0],args[1]);
 }
 
-object *fn_atom (object *args, object *env) {
+object *fn_atom (object **args, object *env) {
   (void) env;
-  return atom(first(args)) ? tee : nil;
+  return atom(args[0]) ? tee : nil;
 }
 
-object *fn_listp (object *args, object *env) {
+object *fn_listp (object **args, object *env) {
   (void) env;
-  return listp(first(args)) ? tee : nil;
+  return listp(args[0]) ? tee : nil;
 }
 
-object *fn_consp (object *args, object *env) {
+object *fn_consp (object **args, object *env) {
   (void) env;
-  return consp(first(args)) ? tee : nil;
+  return consp(args[0]) ? tee : nil;
 }
 
-object *fn_symbolp (object *args, object *env) {
+object *fn_symbolp (object **args, object *env) {
   (void) env;
-  return symbolp(first(args)) ? tee : nil;
+  return symbolp(args[0]) ? tee : nil;
 }
 
-object *fn_eq (object *args, object *env) {
+object *fn_eq (object **args, object *env) {
   (void) env;
-  return eq(first(args), second(args)) ? tee : nil;
+  return eq(args[0], args[1]) ? tee : nil;
 }
 
 // List functions
 
-object *fn_car (object *args, object *env) {
+object *fn_car (object **args, object *env) {
   (void) env;
-  return carx(first(args));
+  return carx(args[0]);
 }
 
-object *fn_cdr (object *args, object *env) {
+object *fn_cdr (object **args, object *env) {
   (void) env;
-  return cdrx(first(args));
+  return cdrx(args[0]);
 }
 
 // System functions
 
-object *fn_eval (object *args, object *env) {
-  return eval(first(args), env);
+// The form is evaluated at the top level, outside any function, so a RETURN
+// in it has no LOOP to end and mustn't leave ReturnFlag set for the caller's.
+object *fn_eval (object **args, object *env) {
+  (void) env;
+  object *result = eval(resolve(args[0], NULL), NULL);
+  ReturnFlag = 0;
+  return result;
 }
 
-object *fn_globals (object *args, object *env) {
+object *fn_globals (object **args, object *env) {
   (void) args, (void) env;
   return GlobalEnv;
 }
 
-object *fn_locals (object *args, object *env) {
+object *fn_locals (object **args, object *env) {
   (void) args;
   return env;
 }
 
+// Images
+
+// SAVE collects, then writes the live cells with their mark bitmap, the
+// symbol names and the global environment to the simulator's block device.
+// LOAD reads them back and relocates the cells if the workspace has moved.
+
+#define IMAGEMAGIC 0x554c5331         /* "ULS1" */
+
+typedef struct {
+  uint32_t magic;
+  uint32_t builtins;                  // builtinshash() must match
+  object *workspace;
+  unsigned int ncells;                // cells up to the last live one
+  unsigned int namesused;
+  unsigned int symbols;
+  object *globalenv;
+  object *tee;
+} image_t;
+
+image_t Image;
+
+// Symbols in an image refer to builtins by number, so an image only loads
+// into a ulisp with the same builtin names in the same order. This hashes
+// them in table order, so reordering or renaming any changes it.
+uint32_t builtinshash () {
+  uint32_t h = 5381;
+  for (int i=0; i<ENDFUNCTIONS; i++) h = hashname(lookupbuiltin(i), h);
+  return h;
+}
+
+object *fn_save (object **args, object *env) {
+  (void) args;
+  gc(NULL, env);
+  unsigned int ncells = WorkspaceSize;
+  while (ncells > 0 && !marked(&Workspace[ncells-1])) ncells--;
+  Image.magic = IMAGEMAGIC;
+  Image.builtins = builtinshash();
+  Image.workspace = Workspace;
+  Image.ncells = ncells;
+  Image.namesused = NamesUsed;
+  Image.symbols = Symbols;
+  Image.globalenv = GlobalEnv;
+  Image.tee = tee;
+  if (blkopen(1) != 0 || blkwrite(&Image, sizeof(Image)) != 0 ||
+    blkwrite(Names, NamesUsed) != 0 || blkwrite(Symtab, sizeof(Symtab)) != 0 ||
+    blkwrite(Marks, (ncells+7)/8) != 0 || blkwrite(Workspace, ncells*sizeof(object)) != 0) error("SAVE FAILED");
+  return tee;
+}
+
+object *relocate (object *obj, uintptr_t delta) {
+  return (obj == NULL) ? NULL : (object *)((uintptr_t)obj + delta);
+}
+
+object *fn_load (object **args, object *env) {
+  (void) args, (void) env;
+  if (blkopen(0) != 0 || blkread(&Image, sizeof(Image)) != 0) error("LOAD FAILED");
+  if (Image.magic != IMAGEMAGIC || Image.builtins != builtinshash()) error("NOT AN IMAGE");
+  if (Image.ncells > WorkspaceSize || Image.namesused > NAMESSIZE) error("IMAGE TOO BIG");
+
+  // Past here the workspace is overwritten, so a failure has to start over
+  unsigned int ncells = Image.ncells;
+  clearmarks();
+  if (blkread(Names, Image.namesused) != 0 || blkread(Symtab, sizeof(Symtab)) != 0 ||
+    blkread(Marks, (ncells+7)/8) != 0 || blkread(Workspace, ncells*sizeof(object)) != 0) {
+    for (unsigned int i=0; i<SYMTABSIZE; i++) Symtab[i] = 0;
+    NamesUsed = 0;
+    Symbols = 0;
+    initworkspace();
+    initenv();
+    error("LOAD FAILED");
+  }
+  NamesUsed = Image.namesused;
+  Symbols = Image.symbols;
+
+  uintptr_t delta = (uintptr_t)Workspace - (uintptr_t)Image.workspace;
+  Freespace = WorkspaceSize;
+  for (unsigned int i=0; i<ncells; i++) {
+    object *obj = &Workspace[i];
+    if (!marked(obj)) continue;
+    Freespace--;
+    unsigned int type = obj->type;
+    if (type >= PAIR || type == ZERO) {
+      car(obj) = relocate(car(obj), delta);
+      cdr(obj) = relocate(cdr(obj), delta);
+    }
+  }
+  Sweep = 0;
+  GlobalEnv = relocate(Image.globalenv, delta);
+  tee = relocate(Image.tee, delta);
+
+  // Whatever called LOAD is gone with the old workspace
+  pfl();
+  restart();
+  return nil;
+}
+
+// Prints the collection and allocation counts, for the benchmark driver
+object *fn_stats (object **args, object *env) {
+  (void) args, (void) env;
+  pfl(); pstring("GCS: "); pint(GCCount); pln();
+  pstring("ALLOCS: "); pint(AllocCount); pln();
+  return nil;
+}
+
 // Insert your own function definitions here
 
 // Built-in procedure names
@@ -468,68 +790,72 @@ const char string0[] = "SYMBOLS";
 const char string1[] = "NIL";
 const char string2[] = "T";
 const char string3[] = "LAMBDA";
-const char string4[] = "SPECIAL_FORMS";
-const char string5[] = "QUOTE";
-const char string6[] = "DEFUN";
-const char string7[] = "DEFVAR";
-const char string8[] = "SETQ";
-const char string9[] = "IF";
-const char string10[] = "FUNCTIONS";
-const char string11[] = "NOT";
-const char string12[] = "NULL";
-const char string13[] = "CONS";
-const char string14[] = "ATOM";
-const char string15[] = "LISTP";
-const char string16[] = "CONSP";
-const char string17[] = "SYMBOLP";
-const char string18[] = "EQ";
-const char string19[] = "CAR";
-const char string20[] = "CDR";
-const char string21[] = "EVAL";
-const char string22[] = "GLOBALS";
-const char string23[] = "LOCALS";
+const char string4[] = "CLOSURE";
+const char string5[] = "SPECIAL_FORMS";
+const char string6[] = "QUOTE";
+const char string7[] = "DEFUN";
+const char string8[] = "DEFVAR";
+const char string9[] = "SETQ";
+const char string10[] = "LOOP";
+const char string11[] = "RETURN";
+const char string12[] = "TAIL_FORMS";
+const char string13[] = "LET";
+const char string14[] = "IF";
+const char string15[] = "FUNCTIONS";
+const char string16[] = "NOT";
+const char string17[] = "NULL";
+const char string18[] = "CONS";
+const char string19[] = "ATOM";
+const char string20[] = "LISTP";
+const char string21[] = "CONSP";
+const char string22[] = "SYMBOLP";
+const char string23[] = "EQ";
+const char string24[] = "CAR";
+const char string25[] = "CDR";
+const char string26[] = "EVAL";
+const char string27[] = "GLOBALS";
+const char string28[] = "LOCALS";
+const char string29[] = "SAVE";
+const char string30[] = "LOAD";
+const char string31[] = "STATS";
 
 const tbl_entry_t lookup_table[] = {
-  { string0, NULL, NIL, NIL },
-  { string1, NULL, 0, 0 },
-  { string2, NULL, 1, 0 },
-  { string3, NULL, 0, 127 },
-  { string4, NULL, NIL, NIL },
-  { string5, sp_quote, 1, 1 },
-  { string6, sp_defun, 0, 127 },
-  { string7, sp_defvar, 2, 2 },
-  { string8, sp_setq, 2, 2 },
-  { string9, sp_if, 2, 3 },
-  { string10, NULL, NIL, NIL },
-  { string11, fn_not, 1, 1 },
-  { string12, fn_not, 1, 1 },
-  { string13, fn_cons, 2, 2 },
-  { string14, fn_atom, 1, 1 },
-  { string15, fn_listp, 1, 1 },
-  { string16, fn_consp, 1, 1 },
-  { string17, fn_symbolp, 1, 1 },
-  { string18, fn_eq, 2, 2 },
-  { string19, fn_car, 1, 1 },
-  { string20, fn_cdr, 1, 1 },
-  { string21, fn_eval, 1, 1 },
-  { string22, fn_globals, 0, 0 },
-  { string23, fn_locals, 0, 0 },
+  { string0, NULL, NULL, NIL, NIL },
+  { string1, NULL, NULL, 0, 0 },
+  { string2, NULL, NULL, 1, 0 },
+  { string3, NULL, NULL, 0, 127 },
+  { string4, NULL, NULL, 0, 127 },
+  { string5, NULL, NULL, NIL, NIL },
+  { string6, sp_quote, NULL, 1, 1 },
+  { string7, sp_defun, NULL, 0, 127 },
+  { string8, sp_defvar, NULL, 2, 2 },
+  { string9, sp_setq, NULL, 2, 2 },
+  { string10, sp_loop, NULL, 0, 127 },
+  { string11, sp_return, NULL, 0, 1 },
+  { string12, NULL, NULL, NIL, NIL },
+  { string13, NULL, NULL, 1, 127 },
+  { string14, tf_if, NULL, 2, 3 },
+  { string15, NULL, NULL, NIL, NIL },
+  { string16, NULL, fn_not, 1, 1 },
+  { string17, NULL, fn_not, 1, 1 },
+  { string18, NULL, fn_cons, 2, 2 },
+  { string19, NULL, fn_atom, 1, 1 },
+  { string20, NULL, fn_listp, 1, 1 },
+  { string21, NULL, fn_consp, 1, 1 },
+  { string22, NULL, fn_symbolp, 1, 1 },
+  { string23, NULL, fn_eq, 2, 2 },
+  { string24, NULL, fn_car, 1, 1 },
+  { string25, NULL, fn_cdr, 1, 1 },
+  { string26, NULL, fn_eval, 1, 1 },
+  { string27, NULL, fn_globals, 0, 0 },
+  { string28, NULL, fn_locals, 0, 0 },
+  { string29, NULL, fn_save, 0, 0 },
+  { string30, NULL, fn_load, 0, 0 },
+  { string31, NULL, fn_stats, 0, 0 },
 };
 
 // Table lookup functions
 
-bool streq (char const * a, char const * b) {
-	for (;;) {
-		if (*a != *b) {
-			return false;
-		}
-		if (*a == '\0') {
-			return true;
-		}
-		a++, b++;
-	}
-}
-
 void strcpy (char* dest, char const * src) {
 	for (;;) {
 		*dest = *src;
@@ -540,13 +866,10 @@ void strcpy (char* dest, char const * src) {
 	}
 }
 
+// BuiltinSlots is a perfect hash of the builtin names, generated by ulisp-phash
 int builtin (char* n) {
-  int entry = 0;
-  while (entry < ENDFUNCTIONS) {
-   if (streq(n, lookup_table[entry].string))
-      return entry;
-    entry++;
-  }
+  int entry = BuiltinSlots[hashname(n, BUILTIN_SEED) & (BUILTIN_SLOTS-1)];
+  if (entry < ENDFUNCTIONS && streq(n, lookup_table[entry].string)) return entry;
   return ENDFUNCTIONS;
 }
 
@@ -554,6 +877,10 @@ fn_ptr_type lookupfn (symbol_t name) {
   return lookup_table[name].fptr;
 }
 
+fn_args_type lookupfargs (symbol_t name) {
+  return lookup_table[name].fargs;
+}
+
 int lookupmin (symbol_t name) {
   return lookup_table[name].min;
 }
@@ -569,25 +896,52 @@ char const * lookupbuiltin (symbol_t name) {
 
 // Main evaluator
 
+// A call made in tail position, from the last form of a lambda body or LET,
+// or a branch of an IF there, loops back to EVAL instead of recursing. So a
+// loop written as tail recursion runs in constant stack.
+//
+// Once evaluate has entered a closure or LET, nothing else may point to its
+// code or its frame, so it roots them in Args[frame] and Args[frame+1]. A tail
+// call replaces both, and eval pops them on the way out.
+
+object *evaluate (object *form, object *env);
+
 object *eval (object *form, object *env) {
+  unsigned int frame = Argp;
+  object *result = evaluate(form, env);
+  Argp = frame;
+  return result;
+}
+
+void enter (unsigned int frame, object *code, object *env) {
+  if (frame + 2 > ARGSTACKSIZE) error("ARGUMENT STACK FULL");
+  Args[frame] = code;
+  Args[frame+1] = env;
+  Argp = frame + 2;
+}
+
+object *evaluate (object *form, object *env) {
+  unsigned int frame = Argp;
+  checkstack();
+  EVAL:
   // Enough space?
   if (Freespace < 20) gc(form, env);
   // Escape
   if (Escape) { Escape = 0; error("ESCAPE!");}
-  
+
   if (form == NULL) return nil;
 
+  if (form->type == LOCAL) return car(slot(form, env));
+
   if (symbolp(form)) {
     symbol_t name = form->name;
     if (name == NIL) return nil;
-    object *pair = value(name, env);
-    if (pair != NULL) return cdr(pair);
-    pair = value(name, GlobalEnv);
+    object *pair = value(name, GlobalEnv);
     if (pair != NULL) return cdr(pair);
     else if (name <= ENDFUNCTIONS) return form;
     error2(form, "UNDEFINED");
   }
-  
+
   // It's a list
   object *function = car(form);
   object *args = cdr(form);
@@ -598,50 +952,63 @@ object *eval (object *form, object *env) {
 
     if (name == LAMBDA) {
       if (env == NULL) return form;
-      error("CLOSURES NOT SUPPORTED");
+      return cons(symbol(CLOSURE), cons(env, args));
     }
-    
-    if ((name > SPECIAL_FORMS) && (name < FUNCTIONS)) {
+
+    if ((name > SPECIAL_FORMS) && (name < TAIL_FORMS)) {
       return ((fn_ptr_type)lookupfn(name))(args, env);
     }
+
+    if (name == LET) {
+      unsigned int base = Argp;
+      for (object *b = first(args); b != NULL; b = cdr(b)) {
+        object *obj = consp(car(b)) ? eval(second(car(b)), env) : nil;
+        if (Argp == ARGSTACKSIZE) error("ARGUMENT STACK FULL");
+        Args[Argp++] = obj;
+      }
+      env = mkframe(env, &Args[base], Argp - base);
+      enter(frame, form, env);
+      form = progn(cdr(args), env);
+      goto EVAL;
+    }
+
+    if ((name > TAIL_FORMS) && (name < FUNCTIONS)) {
+      form = ((fn_ptr_type)lookupfn(name))(args, env);
+      goto EVAL;
+    }
   }
-        
-  // Evaluate the parameters - result in head
+
+  // Evaluate the function and the parameters onto Args
   object *fname = car(form);
-  object *head = cons(eval(car(form), env), NULL);
-  push(head, GCStack); // Don't GC the result list
-  object *tail = head;
-  form = cdr(form);
-  int nargs = 0;
+  unsigned int base = Argp;
 
   while (form != NULL) {
-    object *obj = cons(eval(car(form),env),NULL);
-    cdr(tail) = obj;
-    tail = obj;
+    object *obj = eval(car(form), env);
+    if (Argp == ARGSTACKSIZE) error("ARGUMENT STACK FULL");
+    Args[Argp++] = obj;
     form = cdr(form);
-    nargs++;
   }
-    
-  function = car(head);
-  args = cdr(head);
- 
+
+  function = Args[base];
+  int nargs = Argp - base - 1;
+
   if (symbolp(function)) {
     symbol_t name = function->name;
-    if (name >= ENDFUNCTIONS) error2(fname, "IS NOT VALID HERE");
+    if (name >= ENDFUNCTIONS || lookupfargs(name) == NULL) error2(fname, "IS NOT VALID HERE");
     if (nargs<lookupmin(name)) error2(fname, "HAS TOO FEW ARGUMENTS");
     if (nargs>lookupmax(name)) error2(fname, "HAS TOO MANY ARGUMENTS");
-    object *result = ((fn_ptr_type)lookupfn(name))(args, env);
-    pop(GCStack);
+    object *result = lookupfargs(name)(&Args[base+1], env);
+    Argp = base;
     return result;
   }
-      
-  if (listp(function) && issymbol(car(function), LAMBDA)) {
-    dropframe(0, &env);
-    form = closure(fname, cdr(function), args, &env);
-    pop(GCStack);
-    return eval(form, env);
-  } 
-  
+
+  if (consp(function) && (issymbol(car(function), LAMBDA) || issymbol(car(function), CLOSURE))) {
+    form = closure(fname, function, &Args[base+1], nargs, &env);
+    enter(frame, function, env);
+    form = progn(form, env);
+    goto EVAL;
+  }
+
   error2(fname, "IS AN ILLEGAL FUNCTION"); return nil;
 }
 
@@ -653,8 +1020,8 @@ void cout(char c) {
 }
 
 char rdkey() {
-	const uint32_t rdkeya = 0xfd0c;
-	return (char)syscall(rdkeya, 0);
+	const uint32_t kbgetca = 0x080c;
+	return (char)syscall(kbgetca, 0);
 }
 
 void pchar (char c) {
@@ -666,13 +1033,6 @@ void pstring (char const * s) {
   while (*s) pchar(*s++);
 }
 
-int abs(int i) {
-	if (i < 0) {
-		return -i;
-	}
-	return i;
-}
-
 //void phex(uint8_t b) {
 //	uint8_t n = b & 0xf;
 //	pchar(n + (n < 10 ? '0' : 'A'));
@@ -684,20 +1044,9 @@ int abs(int i) {
 //}
 
 void pint (int n) {
-//	unsigned int u = n;
-//	pchar('$');
-//	pbyte(u >> 24);
-//	pbyte(u >> 16);
-//	pbyte(u >> 8);
-//	pbyte(u);
-
-  int lead = 0;
-  if (n<0) pchar('-');
-  for (int d=10000; d>0; d=d/10) {
-    int j = n/d;
-    if (j!=0 || lead || d==1) { pchar(abs(j)+'0'); lead=1;}
-    n = n - j*d;
-  }
+  char buf[12];
+  fmtint(buf, n);
+  pstring(buf);
 }
 
 void pln () {
@@ -709,6 +1058,7 @@ void pfl () {
 }
 
 void printobject(object *form){
+  checkstack();
   if (form == NULL) pstring("NIL");
   else if (listp(form)) {
     pchar('(');
@@ -724,7 +1074,7 @@ void printobject(object *form){
       printobject(form);
     }
     pchar(')');
-  } else if (symbolp(form)) {
+  } else if (symbolp(form) || form->type == LOCAL) {
     pstring(name(form));
   } else
     error("ERROR IN PRINT.");
@@ -743,7 +1093,7 @@ int gchar () {
 }
 
 bool isspace(char c) {
-	return c == ' ' || c == '\t';
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
 }
 
 object *nextitem() {
@@ -764,7 +1114,6 @@ object *nextitem() {
   
   // Parse variable
   int index = 0;
-  Buffer[2] = '\0'; // In case variable is one letter
 
   while(!isspace(ch) && ch != ')' && ch != '(' && index < BUFFERSIZE-1) {
     Buffer[index++] = ch;
@@ -778,12 +1127,11 @@ object *nextitem() {
   int x = builtin(Buffer);
   if (x == NIL) return nil;
   if (x < ENDFUNCTIONS) return symbol(x);
-  else if (index < 4 && valid40(Buffer)) return symbol(pack40(Buffer));
-  error("ILLEGAL SYMBOL");
-  return nil;
+  return symbol(intern(Buffer));
 }
 
 object *readrest() {
+  checkstack();
   object *item = nextitem();
 
   if(item == (object *)KET) return NULL;
@@ -839,7 +1187,8 @@ void repl(object *env) {
     if (line == (object *)KET) error("UNMATCHED RIGHT BRACKET");
     push(line, GCStack);
     pfl();
-    line = eval(line, env);
+    line = eval(resolve(line, NULL), env);
+    ReturnFlag = 0; // A RETURN outside any LOOP
     pfl();
     printobject(line);
     pop(GCStack);